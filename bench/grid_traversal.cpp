@@ -0,0 +1,125 @@
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <SFML/Graphics.hpp>
+#include <glm/glm.hpp>
+
+#include "density_generator.hpp"
+#include "lsvo.hpp"
+#include "grid_3d.hpp"
+#include "mipmap_grid3D.hpp"
+
+
+// Times primary rays through the same dense cave terrain stored as a packed Grid3D, a MipmapGrid3D and an LSVO.
+// Grids work in voxel space while the LSVO maps the world to [1, 2] with mirrored coordinates, rays are converted
+// so all volumes see the same rays and their hits are compared. Build with -DVOXEL_BUILD_BENCHMARKS=ON.
+constexpr uint8_t max_depth = 8;
+constexpr int32_t size = 1 << max_depth;
+using Grid = Grid3D<size, size, size>;
+using MipmapGrid = MipmapGrid3D<size, size, size, 4>;
+
+struct CameraRay
+{
+	glm::vec3 position;
+	glm::vec3 direction;
+};
+
+template<typename Volume>
+std::vector<float> timeRays(const char* name, const Volume& volume, const std::vector<CameraRay>& rays, uint32_t pass_count)
+{
+	std::vector<float> distances(rays.size());
+	uint64_t complexity = 0u;
+	uint32_t hits = 0u;
+	sf::Clock clock;
+	for (uint32_t pass(0u); pass < pass_count; ++pass) {
+		for (uint32_t i(0u); i < rays.size(); ++i) {
+			const HitPoint hit = volume.castRay(rays[i].position, rays[i].direction);
+			distances[i] = hit.cell ? hit.distance : -1.0f;
+			complexity += hit.complexity;
+			hits += hit.cell != nullptr;
+		}
+	}
+	const float time = clock.getElapsedTime().asSeconds() / float(pass_count);
+	const float ray_count = float(rays.size());
+	std::cout << name << ": " << 1000.0f * time << " ms, " << ray_count / time * 1e-6f << " Mrays/s, "
+		<< float(complexity) / (ray_count * pass_count) << " iterations per ray, "
+		<< 100.0f * float(hits) / (ray_count * pass_count) << "% hits" << std::endl;
+	return distances;
+}
+
+uint32_t countMismatches(const std::vector<float>& distances, const std::vector<float>& reference)
+{
+	uint32_t mismatches = 0u;
+	for (uint32_t i(0u); i < distances.size(); ++i) {
+		const bool hit = distances[i] >= 0.0f;
+		if (hit != (reference[i] >= 0.0f) || (hit && std::abs(distances[i] - reference[i]) > 1e-2f)) {
+			++mismatches;
+		}
+	}
+	return mismatches;
+}
+
+int32_t main()
+{
+	constexpr uint32_t RENDER_WIDTH = 640;
+	constexpr uint32_t RENDER_HEIGHT = 360;
+	const uint32_t pass_count = 4u;
+
+	DensityGenerator<max_depth> density_generator;
+	density_generator.surface_y = 0.4f * size;
+	density_generator.cave_amplitude = 0.5f;
+
+	// The generator classifies whole octree nodes, single voxels are solid where the density at their center is
+	SVO<max_depth> svo;
+	density_generator.generateBrick(svo, glm::ivec3(0));
+	swrm::Swarm swarm(std::max(1U, std::thread::hardware_concurrency()));
+	const LSVO<max_depth> lsvo(svo, swarm);
+	std::unique_ptr<Grid> grid(new Grid());
+	std::unique_ptr<MipmapGrid> mipmap_grid(new MipmapGrid());
+	uint32_t solid_count = 0u;
+	for (int32_t x(0); x < size; ++x) {
+		for (int32_t y(0); y < size; ++y) {
+			for (int32_t z(0); z < size; ++z) {
+				if (density_generator.getDensity(x + 0.5f, y + 0.5f, z + 0.5f) > 0.0f) {
+					grid->setCell(Cell::Solid, Cell::Grass, x, y, z);
+					mipmap_grid->setCell(Cell::Solid, Cell::Grass, x, y, z);
+					++solid_count;
+				}
+			}
+		}
+	}
+	std::cout << "Solid voxels " << solid_count << ", LSVO nodes " << lsvo.data.size() << std::endl;
+
+	// Pinhole camera above the terrain looking down the caves, in grid voxel space
+	const glm::vec3 camera_position(0.5f * size, 0.15f * size, 0.1f * size);
+	const glm::vec3 forward = glm::normalize(glm::vec3(0.1f, 0.6f, 1.0f));
+	const glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 1.0f, 0.0f)));
+	const glm::vec3 up = glm::cross(right, forward);
+	std::vector<CameraRay> rays(RENDER_WIDTH * RENDER_HEIGHT);
+	for (uint32_t y(0u); y < RENDER_HEIGHT; ++y) {
+		for (uint32_t x(0u); x < RENDER_WIDTH; ++x) {
+			const float u = (float(x) - 0.5f * RENDER_WIDTH) / RENDER_HEIGHT;
+			const float v = (float(y) - 0.5f * RENDER_HEIGHT) / RENDER_HEIGHT;
+			rays[y * RENDER_WIDTH + x] = {camera_position, glm::normalize(forward + u * right + v * up)};
+		}
+	}
+
+	const std::vector<float> grid_distances = timeRays("Grid3D", *grid, rays, pass_count);
+	const std::vector<float> mipmap_distances = timeRays("MipmapGrid3D", *mipmap_grid, rays, pass_count);
+	// Render voxel r holds world voxel size - 1 - r, the LSVO sees mirrored rays and its distances are in render units
+	std::vector<CameraRay> lsvo_rays(rays);
+	for (CameraRay& ray : lsvo_rays) {
+		ray.position = glm::vec3(2.0f) - ray.position / float(size);
+		ray.direction = -ray.direction;
+	}
+	std::vector<float> lsvo_distances = timeRays("LSVO", lsvo, lsvo_rays, pass_count);
+	for (float& distance : lsvo_distances) {
+		distance = distance >= 0.0f ? distance * size : distance;
+	}
+	// The LSVO misses a few grazing hits on the last voxel layer of the world
+	std::cout << "Mismatches with Grid3D: MipmapGrid3D " << countMismatches(mipmap_distances, grid_distances)
+		<< ", LSVO " << countMismatches(lsvo_distances, grid_distances) << std::endl;
+
+	return 0;
+}
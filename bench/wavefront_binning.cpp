@@ -0,0 +1,84 @@
+#include <iostream>
+#include <thread>
+#include <SFML/Graphics.hpp>
+#include <glm/glm.hpp>
+
+#include "swarm/swarm.hpp"
+#include "raycaster.hpp"
+#include "density_generator.hpp"
+#include "chunked_world.hpp"
+#include "wavefront.hpp"
+
+
+// Times the GI bounces of the wavefront renderer with binning off, binned in the legacy [1, 2] volume and binned
+// in the streamed window. The camera is far from [1, 2] like after flying a while, the view and the world are fixed
+// so runs can be compared. Build with -DVOXEL_BUILD_BENCHMARKS=ON and run from the build directory (res/ is needed).
+int32_t main()
+{
+	constexpr uint32_t RENDER_WIDTH = 960;
+	constexpr uint32_t RENDER_HEIGHT = 540;
+	constexpr uint8_t max_depth = 9;
+	constexpr int32_t size = 1 << max_depth;
+	constexpr float scale = 1.0f / size;
+	constexpr uint8_t chunk_depth = 5;
+	const uint32_t warm_up_frames = 4U;
+	const uint32_t frame_count = 60U;
+
+	const uint32_t thread_count = std::max(1U, std::thread::hardware_concurrency());
+	swrm::Swarm swarm(thread_count);
+
+	Camera camera;
+	camera.position = glm::vec3(1400, 250, 900);
+	camera.fov = 1.0f;
+	camera.setViewAngle(glm::vec2(0.6f, 0.3f));
+
+	DensityGenerator<max_depth> density_generator;
+	density_generator.cave_amplitude = 0.5f;
+	ChunkedWorld<chunk_depth, LSVO> world([&](SVO<chunk_depth>& chunk, const glm::ivec3& origin) {
+		density_generator.generateBrick(chunk, origin);
+	}, 8U, 4U, size);
+	world.max_chunks_per_update = 0U;
+
+	RayCaster raycaster(world, sf::Vector2i(RENDER_WIDTH, RENDER_HEIGHT));
+	raycaster.ray_size_coef = 1.0f / (float(RENDER_HEIGHT) * camera.fov);
+	raycaster.use_gi = true;
+	raycaster.setLightPosition(glm::vec3(-200, -1000, -300) * scale + glm::vec3(1.0f));
+
+	WavefrontRenderer wavefront(raycaster, swarm, thread_count);
+	// Chunks are generated when rays first reach them, frames are rendered until the view is fully loaded
+	swrm::Swarm streaming_swarm(1U);
+	const glm::vec3 render_position = camera.position * scale + glm::vec3(1.0f);
+	for (uint32_t i(0U); i < 1000U; ++i) {
+		// Centers the window before the first frame, then publishes what the previous frame requested
+		world.update(render_position, streaming_swarm);
+		wavefront.render(camera, scale, int32_t(i & 1U));
+		if (!world.getPendingCount()) {
+			break;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	std::cout << "Loaded chunks " << world.getLoadedCount() << std::endl;
+
+	// Modes alternate frame after frame so they see the same machine load
+	const char* names[3] = {"No binning", "Binned in [1, 2]", "Binned in the window"};
+	float gi_times[3] = {0.0f, 0.0f, 0.0f};
+	float frame_times[3] = {0.0f, 0.0f, 0.0f};
+	for (uint32_t i(0U); i < 3U * (warm_up_frames + frame_count); ++i) {
+		const uint32_t mode = i % 3U;
+		wavefront.bin_gi_rays = mode != 0U;
+		wavefront.bin_min = mode == 2U ? world.getWindowMin() : glm::vec3(1.0f);
+		wavefront.bin_max = mode == 2U ? world.getWindowMax() : glm::vec3(2.0f);
+		sf::Clock frame_clock;
+		wavefront.render(camera, scale, int32_t((i / 3U) & 1U));
+		if (i >= 3U * warm_up_frames) {
+			gi_times[mode] += wavefront.gi_time;
+			frame_times[mode] += frame_clock.getElapsedTime().asSeconds();
+		}
+	}
+	for (uint32_t mode(0U); mode < 3U; ++mode) {
+		std::cout << names[mode] << ": GI " << 1000.0f * gi_times[mode] / frame_count << " ms, frame "
+			<< 1000.0f * frame_times[mode] / frame_count << " ms" << std::endl;
+	}
+
+	return 0;
+}
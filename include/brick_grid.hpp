@@ -0,0 +1,177 @@
+#pragma once
+
+#include "lsvo.hpp"
+
+
+// Walks a regular grid of bricks, in grid space a brick has a size of 1
+struct GridDDA
+{
+	// d must not have null components, entry_mask_ is the axis through which the start cell is entered (0 if the ray starts inside)
+	GridDDA(const glm::vec3& start, const glm::vec3& d, float t_start, uint8_t entry_mask_)
+		: t(t_start)
+		, entry_mask(entry_mask_)
+	{
+		const glm::vec3 inv_d = 1.0f / d;
+		cell = glm::ivec3(glm::floor(start + t * d));
+		step = glm::ivec3(d.x > 0.0f ? 1 : -1, d.y > 0.0f ? 1 : -1, d.z > 0.0f ? 1 : -1);
+		t_delta = glm::abs(inv_d);
+		t_max = glm::vec3(
+			(cell.x + (step.x > 0 ? 1.0f : 0.0f) - start.x) * inv_d.x,
+			(cell.y + (step.y > 0 ? 1.0f : 0.0f) - start.y) * inv_d.y,
+			(cell.z + (step.z > 0 ? 1.0f : 0.0f) - start.z) * inv_d.z
+		);
+	}
+
+	// Keeps the start cell inside the grid when the ray enters it exactly on its far faces
+	void clampCell(const glm::ivec3& min, const glm::ivec3& max)
+	{
+		const glm::ivec3 clamped(std::min(std::max(cell.x, min.x), max.x), std::min(std::max(cell.y, min.y), max.y), std::min(std::max(cell.z, min.z), max.z));
+		t_max += glm::vec3(clamped - cell) * glm::vec3(step) * t_delta;
+		cell = clamped;
+	}
+
+	float getExitT() const
+	{
+		return std::min(t_max.x, std::min(t_max.y, t_max.z));
+	}
+
+	void advance()
+	{
+		t = getExitT();
+		if (t_max.x <= t_max.y && t_max.x <= t_max.z) {
+			cell.x += step.x;
+			t_max.x += t_delta.x;
+			entry_mask = 1u;
+		}
+		else if (t_max.y <= t_max.z) {
+			cell.y += step.y;
+			t_max.y += t_delta.y;
+			entry_mask = 2u;
+		}
+		else {
+			cell.z += step.z;
+			t_max.z += t_delta.z;
+			entry_mask = 4u;
+		}
+	}
+
+	glm::ivec3 cell;
+	glm::ivec3 step;
+	glm::vec3 t_max;
+	glm::vec3 t_delta;
+	float t;
+	uint8_t entry_mask;
+};
+
+
+// Returns the step mask of the face through which a ray enters the box whose slabs give t_near
+inline uint8_t getEntryMask(const glm::vec3& t_near)
+{
+	return (t_near.x >= t_near.y && t_near.x >= t_near.z) ? 1u : (t_near.y >= t_near.z ? 2u : 4u);
+}
+
+
+// Same normal and texture coordinates LSVO::castRay computes after a step, position is in brick space
+template<uint8_t B>
+void setBrickEntryNormal(HitPoint& hit, const glm::vec3& d, uint8_t entry_mask)
+{
+	constexpr float BRICK_SIZE = 1 << B;
+	hit.normal = -glm::sign(d) * glm::vec3(float(entry_mask & 1u), float(entry_mask & 2u), float(entry_mask & 4u));
+	if (hit.normal.x) {
+		hit.voxel_coord = glm::vec2(frac(hit.position.z * BRICK_SIZE), frac(hit.position.y * BRICK_SIZE));
+	}
+	else if (hit.normal.y) {
+		hit.voxel_coord = glm::vec2(frac(hit.position.x * BRICK_SIZE), frac(hit.position.z * BRICK_SIZE));
+	}
+	else {
+		hit.voxel_coord = glm::vec2(frac(hit.position.x * BRICK_SIZE), frac(hit.position.y * BRICK_SIZE));
+	}
+}
+
+
+// Hands the mirrors hit in a brick to a handler working in render space, grid space being (render - 1) * grid_scale.
+// The brick goes on with the reflected ray, reflected then tells that its ray isn't the grid's one anymore.
+struct BrickMirrors : public MirrorHandler
+{
+	BrickMirrors(MirrorHandler& mirrors_, float grid_scale_)
+		: mirrors(mirrors_)
+		, grid_scale(grid_scale_)
+		, path_length(0.0f)
+		, cell(0)
+		, t_offset(0.0f)
+		, reflected(false)
+	{}
+
+	bool onMirrorHit(const HitPoint& hit, glm::vec3& start, glm::vec3& direction) override
+	{
+		HitPoint render_hit = hit;
+		render_hit.distance = (t_offset + hit.distance) / grid_scale;
+		render_hit.position = (glm::vec3(cell) + hit.position - 1.0f) / grid_scale + 1.0f;
+		if (!mirrors.onMirrorHit(render_hit, ray_start, ray_direction)) {
+			return false;
+		}
+		path_length += render_hit.distance;
+		reflected = true;
+		t_offset = 0.0f;
+		start = (ray_start - 1.0f) * grid_scale - glm::vec3(cell) + 1.0f;
+		direction = ray_direction;
+		return true;
+	}
+
+	MirrorHandler& mirrors;
+	const float grid_scale;
+	// Current ray in render space and distance covered before it
+	glm::vec3 ray_start;
+	glm::vec3 ray_direction;
+	float path_length;
+	// Brick being traced and where its ray starts on the grid's ray
+	glm::ivec3 cell;
+	float t_offset;
+	bool reflected;
+};
+
+
+// Casts a grid space ray through the brick of the current DDA cell up to t_end, hits further than t_limit are ignored.
+// On hit, distance and position are converted to grid space. Complexity is always accumulated in hit.
+// ray_size_bias is the footprint at t = 0 in grid units, ray_size_coef is unchanged by the change of space.
+// Brick is LSVO or any volume following its conventions, like BrickLSVO.
+// With mirrors the brick follows its own reflections, the cast stops after one: a hit is then on the reflected ray
+// with its distance from the reflection.
+template<template<uint8_t> class Brick, uint8_t B>
+bool castRayInBrick(const Brick<B>& brick, const glm::vec3& start, const glm::vec3& d, const GridDDA& dda, float t_end, float t_limit, float ray_size_coef, float ray_size_bias, HitPoint& hit, BrickMirrors* mirrors = nullptr)
+{
+	uint32_t complexity = hit.complexity;
+	// LSVO rays are limited to a length of 1 so long crossings of a brick take more than one cast
+	for (float t_local(dda.t); t_local < t_end; t_local += 1.0f) {
+		const glm::vec3 local_start = glm::clamp(start + t_local * d - glm::vec3(dda.cell), 0.0f, 1.0f) + 1.0f;
+		// The footprint keeps growing from what the ray already covered before entering this cast
+		HitPoint brick_hit;
+		if (mirrors) {
+			mirrors->cell = dda.cell;
+			mirrors->t_offset = t_local;
+			brick_hit = brick.castMirroredRay(local_start, d, ray_size_coef, ray_size_bias + t_local * ray_size_coef, *mirrors);
+		}
+		else {
+			brick_hit = brick.castRay(local_start, d, ray_size_coef, ray_size_bias + t_local * ray_size_coef);
+		}
+		complexity += brick_hit.complexity;
+		const bool reflected = mirrors && mirrors->reflected;
+		if (brick_hit.cell && (reflected || t_local + brick_hit.distance <= t_limit)) {
+			// A leaf hit right at the brick's boundary didn't step inside the brick so it has no normal
+			if (!reflected && t_local == dda.t && dda.entry_mask && brick_hit.normal == glm::vec3(0.0f)) {
+				setBrickEntryNormal<B>(brick_hit, d, dda.entry_mask);
+			}
+			hit = brick_hit;
+			hit.complexity = complexity;
+			hit.distance = (reflected ? 0.0f : t_local) + brick_hit.distance;
+			hit.position = glm::vec3(dda.cell) + brick_hit.position - 1.0f;
+			return true;
+		}
+		if (reflected) {
+			break;
+		}
+	}
+
+	hit.complexity = complexity;
+	return false;
+}
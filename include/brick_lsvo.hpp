@@ -0,0 +1,472 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include "lsvo.hpp"
+
+
+// Hybrid of a shallow LSVO and dense 16x16x16 bricks: the octree stops 4 levels above the voxels and
+// rays finish with a bitmask DDA inside the bricks they reach, which avoids the pointer hops of the
+// last, densest levels. A brick is a 4x4x4 grid of 64 bit words, each word holding the occupancy of
+// a 4x4x4 block of voxels. The DDA walks the blocks and only steps through the voxels of non empty ones.
+// Same space and conventions as LSVO<MAX_DEPTH> so both are interchangeable.
+template<uint8_t MAX_DEPTH>
+struct BrickLSVO : public Volumetric
+{
+	static constexpr uint8_t BRICK_DEPTH = 4u;
+	static constexpr uint8_t BLOCK_DEPTH = 2u;
+	static_assert(MAX_DEPTH > BRICK_DEPTH, "BrickLSVO needs at least one octree level above the bricks");
+
+	static constexpr uint8_t TOP_DEPTH = MAX_DEPTH - BRICK_DEPTH;
+	static constexpr int32_t BRICK_SIZE = 1 << BRICK_DEPTH;
+	static constexpr int32_t TOP_SIZE = 1 << TOP_DEPTH;
+	static constexpr int32_t BLOCK_SIZE = 1 << BLOCK_DEPTH;
+	static constexpr int32_t BLOCK_COUNT = BRICK_SIZE / BLOCK_SIZE;
+	static constexpr uint32_t NO_BRICK = 0xFFFFFFFFu;
+	static constexpr uint32_t UNIFORM = 0xFFFFFFFFu;
+
+	struct Brick
+	{
+		// One bit per non empty block
+		uint64_t blocks;
+		// Bounds of the voxels, in voxels from the brick's origin
+		glm::vec3 bounds_min;
+		glm::vec3 bounds_max;
+		// Palette index shared by all voxels when voxel_cells is UNIFORM
+		uint16_t cell;
+		// Offset of the brick's per voxel palette indices
+		uint32_t voxel_cells;
+		// Occupancy of the 4x4x4 voxels of each block, in render voxel orientation
+		uint64_t voxels[BLOCK_COUNT * BLOCK_COUNT * BLOCK_COUNT];
+	};
+
+	BrickLSVO(const SVO<MAX_DEPTH>& svo)
+		: m_brick_indices(TOP_SIZE * TOP_SIZE * TOP_SIZE, uint32_t(NO_BRICK))
+	{
+		importFromSVO(svo);
+	}
+
+	void importFromSVO(const SVO<MAX_DEPTH>& svo)
+	{
+		m_bricks.clear();
+		m_voxel_cells.clear();
+		m_palette.clear();
+		std::fill(m_brick_indices.begin(), m_brick_indices.end(), uint32_t(NO_BRICK));
+		import_rec(svo.m_nodes, svo.getNode(svo.m_root), glm::ivec3(0), 1 << MAX_DEPTH);
+		for (Brick& brick : m_bricks) {
+			brick.blocks = 0u;
+			for (uint32_t i(0u); i < BLOCK_COUNT * BLOCK_COUNT * BLOCK_COUNT; ++i) {
+				brick.blocks |= uint64_t(brick.voxels[i] != 0u) << i;
+			}
+		}
+
+		// The top octree only knows which bricks hold voxels
+		SVO<TOP_DEPTH> top_svo;
+		for (int32_t x(0); x < TOP_SIZE; ++x) {
+			for (int32_t y(0); y < TOP_SIZE; ++y) {
+				for (int32_t z(0); z < TOP_SIZE; ++z) {
+					if (m_brick_indices[getBrickIndex(glm::ivec3(x, y, z))] != NO_BRICK) {
+						// LSVO mirrors SVO coordinates so bricks are indexed by render coordinates
+						top_svo.setCell(Cell::Solid, Cell::Grass, TOP_SIZE - 1 - x, TOP_SIZE - 1 - y, TOP_SIZE - 1 - z);
+					}
+				}
+			}
+		}
+		m_top.reset(new LSVO<TOP_DEPTH>(top_svo));
+	}
+
+	bool isEmpty() const
+	{
+		return m_bricks.empty();
+	}
+
+	void setCell(Cell::Type type, Cell::Texture texture, uint32_t x, uint32_t y, uint32_t z) {}
+
+	HitPoint castRay(const glm::vec3& position, glm::vec3 d, const float ray_size_coef = 0.0f, const float ray_size_bias = 0.0f) const override
+	{
+		using TopLSVO = LSVO<TOP_DEPTH>;
+		constexpr float EPS = 1.0f / float(1 << 23);
+		if (std::abs(d.x) < EPS) { d.x = copysign(EPS, d.x); }
+		if (std::abs(d.y) < EPS) { d.y = copysign(EPS, d.y); }
+		if (std::abs(d.z) < EPS) { d.z = copysign(EPS, d.z); }
+
+		// Bricks are walked from the top traversal, which resumes with its stack when the ray leaves them empty handed
+		const VoxelRay ray(position, d, ray_size_coef, ray_size_bias);
+		bool brick_hit = false;
+		HitPoint result = m_top->castRayThroughLeaves(position, d, ray_size_coef, ray_size_bias, [&](const typename TopLSVO::LeafEntry& leaf, HitPoint& hit) -> typename TopLSVO::LeafAction {
+			// Merged top leaves cover several bricks, all holding voxels. Coordinates are clamped so truncating is enough
+			const glm::ivec3 first((leaf.min - 1.0f) * float(TOP_SIZE) + 0.5f);
+			const int32_t count = int32_t(leaf.size * float(TOP_SIZE) + 0.5f);
+			const glm::ivec3 entry((position + leaf.t_min * d - leaf.min) * float(TOP_SIZE));
+			glm::ivec3 brick = first + glm::ivec3(
+				std::min(std::max(entry.x, 0), count - 1),
+				std::min(std::max(entry.y, 0), count - 1),
+				std::min(std::max(entry.z, 0), count - 1));
+			float t = leaf.t_min;
+			uint8_t axis = leaf.normal;
+			while (true) {
+				float t_exit;
+				if (castRayInBrick(brick, ray, position, d, t, axis, hit, t_exit)) {
+					brick_hit = true;
+					return TopLSVO::ReturnHit;
+				}
+				// axis is the single step the ray left the brick through
+				int32_t coord, min;
+				if (axis & 1u) { coord = brick.x += ray.step.x; min = first.x; }
+				else if (axis & 2u) { coord = brick.y += ray.step.y; min = first.y; }
+				else { coord = brick.z += ray.step.z; min = first.z; }
+				if (uint32_t(coord - min) >= uint32_t(count)) {
+					return TopLSVO::SkipLeaf;
+				}
+				t = t_exit;
+			}
+		});
+
+		if (!result.cell) {
+			return result;
+		}
+		if (brick_hit) {
+			// Same length limit as LSVO
+			if (result.distance > 1.0f) {
+				result.cell = nullptr;
+			}
+			return result;
+		}
+		// Rays large enough to see whole nodes as solid stop at the top level, the node may have no brick at this point
+		const uint32_t index = m_brick_indices[getBrickIndex(getBrickAt(result.position))];
+		result.cell = &m_palette[(index == NO_BRICK) ? 0u : m_bricks[index].cell];
+		return result;
+	}
+
+private:
+	// Per ray constants of the brick DDAs, in voxel units
+	struct VoxelRay
+	{
+		VoxelRay(const glm::vec3& position, const glm::vec3& d, float ray_size_coef, float ray_size_bias)
+			: start((position - 1.0f) * float(1 << MAX_DEPTH))
+			, inv_d(1.0f / d)
+			, t_delta(glm::abs(inv_d))
+			, step(d.x > 0.0f ? 1 : -1, d.y > 0.0f ? 1 : -1, d.z > 0.0f ? 1 : -1)
+			, exit_side(d.x > 0.0f ? 1.0f : 0.0f, d.y > 0.0f ? 1.0f : 0.0f, d.z > 0.0f ? 1.0f : 0.0f)
+			, size_coef(ray_size_coef)
+			, size_bias(ray_size_bias * float(1 << MAX_DEPTH))
+		{}
+
+		const glm::vec3 start;
+		const glm::vec3 inv_d;
+		const glm::vec3 t_delta;
+		const glm::ivec3 step;
+		// 1 on the axes where cells are left through their upper face
+		const glm::vec3 exit_side;
+		// Footprint of the ray, the coefficient is the same in voxel units
+		const float size_coef;
+		const float size_bias;
+	};
+
+	std::unique_ptr<LSVO<TOP_DEPTH>> m_top;
+	std::vector<Brick> m_bricks;
+	std::vector<uint32_t> m_brick_indices;
+	std::vector<uint16_t> m_voxel_cells;
+	std::vector<Cell> m_palette;
+
+	static uint32_t getBrickIndex(const glm::ivec3& brick)
+	{
+		return (brick.z * TOP_SIZE + brick.y) * TOP_SIZE + brick.x;
+	}
+
+	static uint32_t getBlockIndex(const glm::ivec3& block)
+	{
+		return (block.z << 4u) | (block.y << 2u) | block.x;
+	}
+
+	// Index of a voxel in its block's word, coordinates are relative to the brick
+	static uint32_t getVoxelBit(const glm::ivec3& voxel)
+	{
+		return ((voxel.z & 3) << 4u) | ((voxel.y & 3) << 2u) | (voxel.x & 3);
+	}
+
+	// Positions returned by LSVO are always inside the hit node
+	static glm::ivec3 getBrickAt(const glm::vec3& position)
+	{
+		const glm::ivec3 brick(glm::floor((position - 1.0f) * float(TOP_SIZE)));
+		return glm::ivec3(
+			std::min(std::max(brick.x, 0), TOP_SIZE - 1),
+			std::min(std::max(brick.y, 0), TOP_SIZE - 1),
+			std::min(std::max(brick.z, 0), TOP_SIZE - 1));
+	}
+
+	uint16_t getPaletteIndex(const Cell& cell)
+	{
+		const uint16_t palette_size = uint16_t(m_palette.size());
+		for (uint16_t i(0u); i < palette_size; ++i) {
+			if (m_palette[i] == cell) {
+				return i;
+			}
+		}
+		m_palette.push_back(cell);
+		return palette_size;
+	}
+
+	// Creates the brick holding render voxel coordinates on first use
+	Brick& getBrick(const glm::ivec3& voxel, uint16_t cell)
+	{
+		uint32_t& index = m_brick_indices[getBrickIndex(glm::ivec3(voxel.x >> BRICK_DEPTH, voxel.y >> BRICK_DEPTH, voxel.z >> BRICK_DEPTH))];
+		if (index == NO_BRICK) {
+			index = uint32_t(m_bricks.size());
+			m_bricks.emplace_back();
+			Brick& brick = m_bricks.back();
+			std::fill(brick.voxels, brick.voxels + BLOCK_COUNT * BLOCK_COUNT * BLOCK_COUNT, 0u);
+			brick.bounds_min = glm::vec3(float(BRICK_SIZE));
+			brick.bounds_max = glm::vec3(0.0f);
+			brick.cell = cell;
+			brick.voxel_cells = UNIFORM;
+		}
+		return m_bricks[index];
+	}
+
+	// Bits of the voxels of a block inside [lo, hi), in voxels from the block's origin
+	static uint64_t getBoxMask(const glm::ivec3& lo, const glm::ivec3& hi)
+	{
+		const uint64_t row = ((uint64_t(1u) << (hi.x - lo.x)) - 1u) << lo.x;
+		uint64_t slice = 0u;
+		for (int32_t y(lo.y); y < hi.y; ++y) {
+			slice |= row << (y << BLOCK_DEPTH);
+		}
+		uint64_t mask = 0u;
+		for (int32_t z(lo.z); z < hi.z; ++z) {
+			mask |= slice << (z << (2u * BLOCK_DEPTH));
+		}
+		return mask;
+	}
+
+	// Fills the region of a solid SVO leaf, min and size are in render voxel coordinates
+	void fillRegion(const glm::ivec3& min, int32_t size, uint16_t cell)
+	{
+		const glm::ivec3 max = min + size;
+		for (int32_t bz(min.z >> BRICK_DEPTH); bz <= ((max.z - 1) >> BRICK_DEPTH); ++bz) {
+			for (int32_t by(min.y >> BRICK_DEPTH); by <= ((max.y - 1) >> BRICK_DEPTH); ++by) {
+				for (int32_t bx(min.x >> BRICK_DEPTH); bx <= ((max.x - 1) >> BRICK_DEPTH); ++bx) {
+					const glm::ivec3 origin = glm::ivec3(bx, by, bz) * BRICK_SIZE;
+					const glm::ivec3 lo(std::max(min.x - origin.x, 0), std::max(min.y - origin.y, 0), std::max(min.z - origin.z, 0));
+					const glm::ivec3 hi(std::min(max.x - origin.x, int32_t(BRICK_SIZE)), std::min(max.y - origin.y, int32_t(BRICK_SIZE)), std::min(max.z - origin.z, int32_t(BRICK_SIZE)));
+					Brick& brick = getBrick(origin, cell);
+					brick.bounds_min = glm::min(brick.bounds_min, glm::vec3(lo));
+					brick.bounds_max = glm::max(brick.bounds_max, glm::vec3(hi));
+					for (int32_t z(lo.z >> BLOCK_DEPTH); z <= ((hi.z - 1) >> BLOCK_DEPTH); ++z) {
+						for (int32_t y(lo.y >> BLOCK_DEPTH); y <= ((hi.y - 1) >> BLOCK_DEPTH); ++y) {
+							for (int32_t x(lo.x >> BLOCK_DEPTH); x <= ((hi.x - 1) >> BLOCK_DEPTH); ++x) {
+								const glm::ivec3 block(x, y, z);
+								const glm::ivec3 block_origin = block * BLOCK_SIZE;
+								const glm::ivec3 block_lo(std::max(lo.x - block_origin.x, 0), std::max(lo.y - block_origin.y, 0), std::max(lo.z - block_origin.z, 0));
+								const glm::ivec3 block_hi(std::min(hi.x - block_origin.x, int32_t(BLOCK_SIZE)), std::min(hi.y - block_origin.y, int32_t(BLOCK_SIZE)), std::min(hi.z - block_origin.z, int32_t(BLOCK_SIZE)));
+								brick.voxels[getBlockIndex(block)] |= getBoxMask(block_lo, block_hi);
+							}
+						}
+					}
+
+					// Bricks only store per voxel cells once they hold different ones
+					if (brick.voxel_cells == UNIFORM && brick.cell != cell) {
+						brick.voxel_cells = uint32_t(m_voxel_cells.size());
+						m_voxel_cells.resize(m_voxel_cells.size() + BRICK_SIZE * BRICK_SIZE * BRICK_SIZE, brick.cell);
+					}
+					if (brick.voxel_cells != UNIFORM) {
+						for (int32_t z(lo.z); z < hi.z; ++z) {
+							for (int32_t y(lo.y); y < hi.y; ++y) {
+								for (int32_t x(lo.x); x < hi.x; ++x) {
+									m_voxel_cells[brick.voxel_cells + getVoxelCellIndex(glm::ivec3(x, y, z))] = cell;
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	static uint32_t getVoxelCellIndex(const glm::ivec3& voxel)
+	{
+		return (voxel.z << (2u * BRICK_DEPTH)) | (voxel.y << BRICK_DEPTH) | voxel.x;
+	}
+
+	// position and size are in SVO voxel coordinates
+	void import_rec(const NodePool& nodes, const Node& node, const glm::ivec3& position, int32_t size)
+	{
+		if (node.leaf) {
+			if (node.cell.type != Cell::Empty) {
+				// LSVO mirrors SVO coordinates on all axes
+				const glm::ivec3 render_min = glm::ivec3((1 << MAX_DEPTH) - size) - position;
+				fillRegion(render_min, size, getPaletteIndex(node.cell));
+			}
+			return;
+		}
+
+		const int32_t sub_size = size >> 1;
+		for (uint8_t x(0u); x < 2u; ++x) {
+			for (uint8_t y(0u); y < 2u; ++y) {
+				for (uint8_t z(0u); z < 2u; ++z) {
+					const uint32_t sub_index = node.sub[x][y][z];
+					if (sub_index != Node::None) {
+						import_rec(nodes, nodes[sub_index], position + sub_size * glm::ivec3(x, y, z), sub_size);
+					}
+				}
+			}
+		}
+	}
+
+	// Walks the brick's blocks from t_entry after clipping the ray to the voxels' bounds, then the voxels of non
+	// empty blocks. On miss t_exit and axis are set to where the ray leaves the brick.
+	bool castRayInBrick(const glm::ivec3& brick_coord, const VoxelRay& ray, const glm::vec3& position, const glm::vec3& d, float t_entry, uint8_t& axis, HitPoint& result, float& t_exit) const
+	{
+		constexpr float SVO_SIZE = 1 << MAX_DEPTH;
+		const Brick& brick = m_bricks[m_brick_indices[getBrickIndex(brick_coord)]];
+		// Work in voxel units relative to the brick's origin, t in voxel units along d
+		const glm::vec3 local_start = ray.start - glm::vec3(brick_coord * BRICK_SIZE);
+		float t = t_entry * SVO_SIZE;
+		uint8_t normal = axis;
+
+		// Rays missing the voxels' bounds leave through the brick's exit face
+		const glm::vec3 t_lo = (brick.bounds_min - local_start) * ray.inv_d;
+		const glm::vec3 t_hi = (brick.bounds_max - local_start) * ray.inv_d;
+		const glm::vec3 t_near(std::min(t_lo.x, t_hi.x), std::min(t_lo.y, t_hi.y), std::min(t_lo.z, t_hi.z));
+		const float t_far = std::min(std::min(std::max(t_lo.x, t_hi.x), std::max(t_lo.y, t_hi.y)), std::max(t_lo.z, t_hi.z));
+		const float t_in = std::max(std::max(t_near.x, t_near.y), t_near.z);
+		if (t_far <= std::max(t, t_in)) {
+			const glm::vec3 t_out = (ray.exit_side * float(BRICK_SIZE) - local_start) * ray.inv_d;
+			if (t_out.x <= t_out.y && t_out.x <= t_out.z) {
+				t_exit = t_out.x;
+				axis = 1u;
+			}
+			else if (t_out.y <= t_out.z) {
+				t_exit = t_out.y;
+				axis = 2u;
+			}
+			else {
+				t_exit = t_out.z;
+				axis = 4u;
+			}
+			t_exit /= SVO_SIZE;
+			return false;
+		}
+		if (t_in > t) {
+			t = t_in;
+			normal = (t_in == t_near.x) ? 1u : ((t_in == t_near.y) ? 2u : 4u);
+		}
+
+		const glm::ivec3 entry((local_start + t * d) * (1.0f / BLOCK_SIZE));
+		glm::ivec3 block(
+			std::min(std::max(entry.x, 0), BLOCK_COUNT - 1),
+			std::min(std::max(entry.y, 0), BLOCK_COUNT - 1),
+			std::min(std::max(entry.z, 0), BLOCK_COUNT - 1));
+		glm::vec3 t_max = (float(BLOCK_SIZE) * (glm::vec3(block) + ray.exit_side) - local_start) * ray.inv_d;
+		while (true) {
+			++result.complexity;
+			const uint32_t block_index = getBlockIndex(block);
+			if ((brick.blocks >> block_index) & 1u) {
+				// Blocks smaller than the ray's footprint are seen as solid, like LSVO nodes
+				const float t_block_exit = std::min(t_max.x, std::min(t_max.y, t_max.z));
+				if (t_block_exit * ray.size_coef + ray.size_bias >= float(BLOCK_SIZE)) {
+					setHit(result, position, d, t / SVO_SIZE, normal, &m_palette[brick.cell]);
+					return true;
+				}
+				if (castRayInBlock(brick, block, brick.voxels[block_index], ray, local_start, position, d, t, normal, result)) {
+					return true;
+				}
+			}
+
+			int32_t coord;
+			if (t_max.x <= t_max.y && t_max.x <= t_max.z) {
+				t = t_max.x;
+				coord = block.x += ray.step.x;
+				t_max.x += float(BLOCK_SIZE) * ray.t_delta.x;
+				normal = 1u;
+			}
+			else if (t_max.y <= t_max.z) {
+				t = t_max.y;
+				coord = block.y += ray.step.y;
+				t_max.y += float(BLOCK_SIZE) * ray.t_delta.y;
+				normal = 2u;
+			}
+			else {
+				t = t_max.z;
+				coord = block.z += ray.step.z;
+				t_max.z += float(BLOCK_SIZE) * ray.t_delta.z;
+				normal = 4u;
+			}
+			if (uint32_t(coord) >= uint32_t(BLOCK_COUNT)) {
+				t_exit = t / SVO_SIZE;
+				axis = normal;
+				return false;
+			}
+		}
+	}
+
+	// Voxel DDA restricted to one block, t is where the ray enters it
+	bool castRayInBlock(const Brick& brick, const glm::ivec3& block, uint64_t voxels, const VoxelRay& ray, const glm::vec3& local_start, const glm::vec3& position, const glm::vec3& d, float t, uint8_t normal, HitPoint& result) const
+	{
+		constexpr float SVO_SIZE = 1 << MAX_DEPTH;
+		const glm::ivec3 entry(local_start + t * d);
+		const glm::ivec3 block_min = block * BLOCK_SIZE;
+		glm::ivec3 voxel(
+			std::min(std::max(entry.x, block_min.x), block_min.x + BLOCK_SIZE - 1),
+			std::min(std::max(entry.y, block_min.y), block_min.y + BLOCK_SIZE - 1),
+			std::min(std::max(entry.z, block_min.z), block_min.z + BLOCK_SIZE - 1));
+		glm::vec3 t_max = (glm::vec3(voxel) + ray.exit_side - local_start) * ray.inv_d;
+		while (true) {
+			++result.complexity;
+			if ((voxels >> getVoxelBit(voxel)) & 1u) {
+				const uint16_t cell = brick.voxel_cells == UNIFORM ? brick.cell : m_voxel_cells[brick.voxel_cells + getVoxelCellIndex(voxel)];
+				setHit(result, position, d, t / SVO_SIZE, normal, &m_palette[cell]);
+				return true;
+			}
+
+			// Leaving the voxel through the block's face means leaving the block
+			if (t_max.x <= t_max.y && t_max.x <= t_max.z) {
+				t = t_max.x;
+				voxel.x += ray.step.x;
+				t_max.x += ray.t_delta.x;
+				normal = 1u;
+				if ((voxel.x >> BLOCK_DEPTH) != block.x) {
+					return false;
+				}
+			}
+			else if (t_max.y <= t_max.z) {
+				t = t_max.y;
+				voxel.y += ray.step.y;
+				t_max.y += ray.t_delta.y;
+				normal = 2u;
+				if ((voxel.y >> BLOCK_DEPTH) != block.y) {
+					return false;
+				}
+			}
+			else {
+				t = t_max.z;
+				voxel.z += ray.step.z;
+				t_max.z += ray.t_delta.z;
+				normal = 4u;
+				if ((voxel.z >> BLOCK_DEPTH) != block.z) {
+					return false;
+				}
+			}
+		}
+	}
+
+	// Same normal and texture coordinates as LSVO::castRay, normal is 0 for rays starting inside a voxel
+	static void setHit(HitPoint& result, const glm::vec3& position, const glm::vec3& d, float t, uint8_t normal, const Cell* cell)
+	{
+		constexpr float SVO_SIZE = 1 << MAX_DEPTH;
+		result.cell = cell;
+		result.distance = t;
+		result.position = position + t * d;
+		result.normal = -glm::sign(d) * glm::vec3(float(normal & 1u), float(normal & 2u), float(normal & 4u));
+
+		if (result.normal.x) {
+			result.voxel_coord = glm::vec2(frac(result.position.z * SVO_SIZE), frac(result.position.y * SVO_SIZE));
+		}
+		else if (result.normal.y) {
+			result.voxel_coord = glm::vec2(frac(result.position.x * SVO_SIZE), frac(result.position.z * SVO_SIZE));
+		}
+		else if (result.normal.z) {
+			result.voxel_coord = glm::vec2(frac(result.position.x * SVO_SIZE), frac(result.position.y * SVO_SIZE));
+		}
+	}
+};
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <glm/glm.hpp>
+
+
+struct AABB
+{
+	AABB()
+		: min(std::numeric_limits<float>::max())
+		, max(-std::numeric_limits<float>::max())
+	{}
+
+	AABB(const glm::vec3& min_, const glm::vec3& max_)
+		: min(min_)
+		, max(max_)
+	{}
+
+	void grow(const glm::vec3& point)
+	{
+		min = glm::min(min, point);
+		max = glm::max(max, point);
+	}
+
+	void grow(const AABB& box)
+	{
+		min = glm::min(min, box.min);
+		max = glm::max(max, box.max);
+	}
+
+	glm::vec3 getCenter() const
+	{
+		return 0.5f * (min + max);
+	}
+
+	// t_entry is only set on hit, rays starting inside the box enter it at 0
+	bool intersect(const glm::vec3& start, const glm::vec3& inv_d, float t_max, float& t_entry) const
+	{
+		const glm::vec3 t_0 = (min - start) * inv_d;
+		const glm::vec3 t_1 = (max - start) * inv_d;
+		const glm::vec3 t_near = glm::min(t_0, t_1);
+		const glm::vec3 t_far = glm::max(t_0, t_1);
+		const float t_in = std::max(0.0f, std::max(t_near.x, std::max(t_near.y, t_near.z)));
+		const float t_out = std::min(t_max, std::min(t_far.x, std::min(t_far.y, t_far.z)));
+		if (t_in > t_out) {
+			return false;
+		}
+		t_entry = t_in;
+		return true;
+	}
+
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+
+// Bounding volume hierarchy over a set of boxes, items are referenced by their index in the box array
+struct BVH
+{
+	static constexpr uint32_t MAX_LEAF_SIZE = 2u;
+	static constexpr uint32_t STACK_SIZE = 64u;
+
+	struct Node
+	{
+		AABB box;
+		// Index of the first item for leaves or of the left child, the right one follows it
+		uint32_t first;
+		// Number of items, 0 for inner nodes
+		uint32_t count;
+	};
+
+	void build(const std::vector<AABB>& boxes)
+	{
+		const uint32_t item_count = uint32_t(boxes.size());
+		nodes.clear();
+		indices.resize(item_count);
+		for (uint32_t i(0u); i < item_count; ++i) {
+			indices[i] = i;
+		}
+		if (!item_count) {
+			return;
+		}
+
+		nodes.reserve(2u * item_count);
+		nodes.emplace_back();
+		build_rec(boxes, 0u, 0u, item_count);
+	}
+
+	// Updates the boxes of the nodes without changing the tree, much cheaper than build when items move a bit.
+	// boxes must hold the same items as when the tree was built.
+	void refit(const std::vector<AABB>& boxes)
+	{
+		// Children are always stored after their parent
+		for (uint32_t i(uint32_t(nodes.size())); i--;) {
+			Node& node = nodes[i];
+			if (node.count) {
+				AABB box;
+				for (uint32_t k(node.first); k < node.first + node.count; ++k) {
+					box.grow(boxes[indices[k]]);
+				}
+				node.box = box;
+			}
+			else {
+				node.box = nodes[node.first].box;
+				node.box.grow(nodes[node.first + 1u].box);
+			}
+		}
+	}
+
+	// Calls on_item(item, t_closest) for every item whose box is reached before t_closest, nearest boxes first.
+	// on_item lowers t_closest when it finds a hit, which prunes the remaining nodes.
+	template<typename Callback>
+	void traverse(const glm::vec3& start, const glm::vec3& d, float& t_closest, Callback on_item) const
+	{
+		if (nodes.empty()) {
+			return;
+		}
+
+		const glm::vec3 inv_d = 1.0f / d;
+		float t_entry;
+		if (!nodes[0].box.intersect(start, inv_d, t_closest, t_entry)) {
+			return;
+		}
+
+		struct StackEntry
+		{
+			uint32_t node;
+			float t_entry;
+		};
+		StackEntry stack[STACK_SIZE];
+		uint32_t stack_size = 0u;
+		stack[stack_size++] = {0u, t_entry};
+		while (stack_size) {
+			const StackEntry entry = stack[--stack_size];
+			// Another item may have been hit since this node was pushed
+			if (entry.t_entry > t_closest) {
+				continue;
+			}
+
+			const Node& node = nodes[entry.node];
+			if (node.count) {
+				for (uint32_t i(node.first); i < node.first + node.count; ++i) {
+					on_item(indices[i], t_closest);
+				}
+				continue;
+			}
+
+			float t_left, t_right;
+			const bool hit_left = nodes[node.first].box.intersect(start, inv_d, t_closest, t_left);
+			const bool hit_right = nodes[node.first + 1u].box.intersect(start, inv_d, t_closest, t_right);
+			// Push the farthest child first so the nearest one is processed next
+			if (hit_left && hit_right) {
+				if (t_left < t_right) {
+					stack[stack_size++] = {node.first + 1u, t_right};
+					stack[stack_size++] = {node.first, t_left};
+				}
+				else {
+					stack[stack_size++] = {node.first, t_left};
+					stack[stack_size++] = {node.first + 1u, t_right};
+				}
+			}
+			else if (hit_left) {
+				stack[stack_size++] = {node.first, t_left};
+			}
+			else if (hit_right) {
+				stack[stack_size++] = {node.first + 1u, t_right};
+			}
+		}
+	}
+
+	std::vector<Node> nodes;
+	std::vector<uint32_t> indices;
+
+private:
+	// Median split on the largest axis of the centers' bounds, keeps the depth logarithmic for the traversal stack
+	void build_rec(const std::vector<AABB>& boxes, uint32_t node_index, uint32_t first, uint32_t count)
+	{
+		AABB box;
+		AABB centers;
+		for (uint32_t i(first); i < first + count; ++i) {
+			box.grow(boxes[indices[i]]);
+			centers.grow(boxes[indices[i]].getCenter());
+		}
+		nodes[node_index].box = box;
+
+		if (count <= MAX_LEAF_SIZE) {
+			nodes[node_index].first = first;
+			nodes[node_index].count = count;
+			return;
+		}
+
+		const glm::vec3 extent = centers.max - centers.min;
+		const uint8_t axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0u : (extent.y >= extent.z ? 1u : 2u);
+		const uint32_t half = count / 2u;
+		std::nth_element(indices.begin() + first, indices.begin() + first + half, indices.begin() + first + count, [&boxes, axis](uint32_t a, uint32_t b) {
+			return boxes[a].getCenter()[axis] < boxes[b].getCenter()[axis];
+		});
+
+		const uint32_t left = uint32_t(nodes.size());
+		nodes.emplace_back();
+		nodes.emplace_back();
+		nodes[node_index].first = left;
+		nodes[node_index].count = 0u;
+		build_rec(boxes, left, first, half);
+		build_rec(boxes, left + 1u, first + half, count - half);
+	}
+};
@@ -19,6 +19,11 @@ struct Cell
 		: type(Type::Empty)
 	{}
 
+	bool operator==(const Cell& other) const
+	{
+		return type == other.type && texture == other.texture;
+	}
+
 	Type type;
 	Texture texture;
 };
@@ -0,0 +1,384 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "brick_grid.hpp"
+#include "swarm/swarm.hpp"
+
+
+// Unbounded world made of LSVO (or BrickLSVO) chunks, only a window of chunks around the camera is kept in memory.
+// Chunks are stored in a ring indexed by their coordinates modulo the window size so moving the window
+// only replaces the slots that left it. Rays walk the window's chunks with a DDA.
+// Chunks are only generated once a ray reaches them: the first ray marks the chunk pending and queues it,
+// rays see pending chunks as empty until update builds them in the background.
+//
+// Render space follows the single LSVO convention: a world of world_size voxels maps to [1, 2] and
+// its voxel coordinates are mirrored, render voxel r holds world voxel world_size - 1 - r.
+template<uint8_t CHUNK_DEPTH, template<uint8_t> class ChunkVolume = LSVO>
+struct ChunkedWorld : public Volumetric
+{
+	static constexpr uint32_t CHUNK_SIZE = 1u << CHUNK_DEPTH;
+
+	using Chunk = ChunkVolume<CHUNK_DEPTH>;
+	// Fills the SVO of the chunk whose first voxel is at the given world voxel coordinates
+	using ChunkGenerator = std::function<void(SVO<CHUNK_DEPTH>&, const glm::ivec3&)>;
+
+	enum ChunkState : uint8_t
+	{
+		Unloaded,
+		Pending,
+		Empty,
+		Ready
+	};
+
+	ChunkedWorld(ChunkGenerator generator_, uint32_t radius, uint32_t height_radius, uint32_t world_size)
+		: generator(generator_)
+		, max_chunks_per_update(128u)
+		, m_radius(radius, height_radius, radius)
+		, m_ring_size(m_radius * 2 + 1)
+		, m_chunk_scale(float(world_size) / float(CHUNK_SIZE))
+		, m_world_chunks(int32_t(world_size / CHUNK_SIZE))
+		, m_slots(new ChunkSlot[m_ring_size.x * m_ring_size.y * m_ring_size.z])
+		, m_center(0)
+		, m_job_running(false)
+		, m_next_task(0u)
+	{}
+
+	~ChunkedWorld()
+	{
+		if (m_job_running) {
+			m_job.waitExecutionDone();
+		}
+	}
+
+	void setCell(Cell::Type type, Cell::Texture texture, uint32_t x, uint32_t y, uint32_t z) {}
+
+	HitPoint castRay(const glm::vec3& position, glm::vec3 d, const float ray_size_coef = 0.0f, const float ray_size_bias = 0.0f) const override
+	{
+		return castRay(position, d, ray_size_coef, ray_size_bias, nullptr);
+	}
+
+	// Chunks follow the reflections on their own mirrors, the window's walk then goes on with the reflected ray
+	HitPoint castMirroredRay(glm::vec3 position, glm::vec3 d, float ray_size_coef, float ray_size_bias, MirrorHandler& mirrors) const override
+	{
+		BrickMirrors chunk_mirrors(mirrors, m_chunk_scale);
+		chunk_mirrors.ray_start = position;
+		chunk_mirrors.ray_direction = d;
+		return castRay(position, d, ray_size_coef, ray_size_bias, &chunk_mirrors);
+	}
+
+	// Moves the window around position (in render space) and generates the chunks requested by rays in the background.
+	// Chunks are only published here so it must not be called while rays are cast.
+	// Returns true if chunks holding voxels were published, the window moving alone doesn't count.
+	bool update(const glm::vec3& position, swrm::Swarm& swarm)
+	{
+		m_center = glm::ivec3(glm::floor((position - 1.0f) * m_chunk_scale));
+		bool changed = false;
+		if (m_job_running) {
+			if (!m_job.isExecutionDone()) {
+				return false;
+			}
+			m_job.waitExecutionDone();
+			m_job_running = false;
+			changed = publishChunks();
+		}
+
+		takeRequests();
+		if (m_tasks.empty()) {
+			return changed;
+		}
+
+		m_next_task = 0u;
+		m_results.resize(m_tasks.size());
+		m_job_running = true;
+		m_job = swarm.execute([this](uint32_t thread_id, uint32_t max_thread) {
+			// Chunks that left the window are freed here rather than on the render thread
+			if (!thread_id) {
+				m_trash.clear();
+			}
+			const uint32_t task_count = uint32_t(m_tasks.size());
+			for (uint32_t i(m_next_task++); i < task_count; i = m_next_task++) {
+				m_results[i] = generateChunk(m_tasks[i]);
+			}
+		});
+		// Requested slots stay pending meanwhile, rays see them as empty
+		return changed;
+	}
+
+	// Drops all the chunks so they are generated again, after the generator changed for instance.
+	// Waits for the running job, it must not be called while rays are cast.
+	void clear()
+	{
+		if (m_job_running) {
+			m_job.waitExecutionDone();
+			m_job_running = false;
+			m_results.clear();
+		}
+		for (uint32_t i(m_ring_size.x * m_ring_size.y * m_ring_size.z); i--;) {
+			m_slots[i].chunk.reset();
+			m_slots[i].state = Unloaded;
+		}
+		m_trash.clear();
+		m_requests.clear();
+	}
+
+	// Bounds of the loaded window in render space
+	glm::vec3 getWindowMin() const
+	{
+		return glm::vec3(m_center - m_radius) / m_chunk_scale + 1.0f;
+	}
+
+	glm::vec3 getWindowMax() const
+	{
+		return glm::vec3(m_center + m_radius + 1) / m_chunk_scale + 1.0f;
+	}
+
+	uint32_t getLoadedCount() const
+	{
+		uint32_t count = 0u;
+		for (uint32_t i(m_ring_size.x * m_ring_size.y * m_ring_size.z); i--;) {
+			count += m_slots[i].state == Ready;
+		}
+		return count;
+	}
+
+	// Chunks requested by rays and not published yet
+	uint32_t getPendingCount() const
+	{
+		std::lock_guard<std::mutex> lg(m_requests_mutex);
+		return uint32_t(m_requests.size()) + (m_job_running ? uint32_t(m_tasks.size()) : 0u);
+	}
+
+	ChunkGenerator generator;
+	// Optional, called by the streaming workers on every non empty chunk before it is published
+	std::function<void(Chunk&)> on_chunk_built;
+	// Limits the number of chunks generated by one background job, closest chunks come first
+	uint32_t max_chunks_per_update;
+
+private:
+	struct ChunkSlot
+	{
+		ChunkSlot()
+			: coord(0)
+			, state(Unloaded)
+		{}
+
+		// Only written by update, rays read it
+		glm::ivec3 coord;
+		std::atomic<uint8_t> state;
+		std::unique_ptr<Chunk> chunk;
+	};
+
+	const glm::ivec3 m_radius;
+	const glm::ivec3 m_ring_size;
+	const float m_chunk_scale;
+	const int32_t m_world_chunks;
+	std::unique_ptr<ChunkSlot[]> m_slots;
+	glm::ivec3 m_center;
+
+	// Background job state, only touched by the job's workers while it runs
+	swrm::WorkGroup m_job;
+	bool m_job_running;
+	std::atomic<uint32_t> m_next_task;
+	std::vector<glm::ivec3> m_tasks;
+	std::vector<std::unique_ptr<Chunk>> m_results;
+	std::vector<std::unique_ptr<Chunk>> m_trash;
+	// Chunks reached by rays, filled while rendering
+	mutable std::vector<glm::ivec3> m_requests;
+	mutable std::mutex m_requests_mutex;
+
+	static int32_t positiveMod(int32_t value, int32_t size)
+	{
+		const int32_t mod = value % size;
+		return mod < 0 ? mod + size : mod;
+	}
+
+	uint32_t getSlotIndex(const glm::ivec3& coord) const
+	{
+		const int32_t x = positiveMod(coord.x, m_ring_size.x);
+		const int32_t y = positiveMod(coord.y, m_ring_size.y);
+		const int32_t z = positiveMod(coord.z, m_ring_size.z);
+		return uint32_t((z * m_ring_size.y + y) * m_ring_size.x + x);
+	}
+
+	bool isInWindow(const glm::ivec3& coord) const
+	{
+		const glm::ivec3 window_min = m_center - m_radius;
+		const glm::ivec3 window_max = m_center + m_radius;
+		return coord.x >= window_min.x && coord.y >= window_min.y && coord.z >= window_min.z
+			&& coord.x <= window_max.x && coord.y <= window_max.y && coord.z <= window_max.z;
+	}
+
+	// castRay handing the chunks' mirrors to mirrors when set, hits are then on the last reflected ray
+	HitPoint castRay(const glm::vec3& position, glm::vec3 d, const float ray_size_coef, const float ray_size_bias, BrickMirrors* mirrors) const
+	{
+		HitPoint result;
+		constexpr float EPS = 1.0f / float(1 << 23);
+		if (std::abs(d.x) < EPS) { d.x = copysign(EPS, d.x); }
+		if (std::abs(d.y) < EPS) { d.y = copysign(EPS, d.y); }
+		if (std::abs(d.z) < EPS) { d.z = copysign(EPS, d.z); }
+		// Work in chunk space where a chunk has a size of 1, only the loaded window is traversed
+		glm::vec3 start = (position - 1.0f) * m_chunk_scale;
+		const glm::ivec3 window_min = m_center - m_radius;
+		const glm::ivec3 window_max = m_center + m_radius;
+		const glm::vec3 inv_d = 1.0f / d;
+		const glm::vec3 t_0 = (glm::vec3(window_min) - start) * inv_d;
+		const glm::vec3 t_1 = (glm::vec3(window_max + 1) - start) * inv_d;
+		const glm::vec3 t_near = glm::min(t_0, t_1);
+		const glm::vec3 t_far = glm::max(t_0, t_1);
+		const float t = std::max(0.0f, std::max(t_near.x, std::max(t_near.y, t_near.z)));
+		float t_exit = std::min(t_far.x, std::min(t_far.y, t_far.z));
+		if (t > t_exit) {
+			return result;
+		}
+		float ray_size_bias_chunk = ray_size_bias * m_chunk_scale;
+
+		GridDDA dda(start, d, t, t > 0.0f ? getEntryMask(t_near) : 0u);
+		dda.clampCell(window_min, window_max);
+		while (dda.t <= t_exit) {
+			ChunkSlot& slot = m_slots[getSlotIndex(dda.cell)];
+			const uint8_t state = slot.state.load(std::memory_order_acquire);
+			// The slot may still hold a chunk that left the window, it is then replaced by the one the ray reached
+			if (slot.coord != dda.cell) {
+				if (state != Pending) {
+					request(slot, state, dda.cell);
+				}
+			}
+			else if (state == Unloaded) {
+				request(slot, state, dda.cell);
+			}
+			else if (state == Ready) {
+				const float t_end = std::min(dda.getExitT(), t_exit);
+				if (castRayInBrick(*slot.chunk, start, d, dda, t_end, t_exit, ray_size_coef, ray_size_bias_chunk, result, mirrors)) {
+					result.distance /= m_chunk_scale;
+					result.position = result.position / m_chunk_scale + 1.0f;
+					return result;
+				}
+				// The reflected ray left the chunk, or reached the length LSVO rays are limited to
+				if (mirrors && mirrors->reflected) {
+					mirrors->reflected = false;
+					start = (mirrors->ray_start - 1.0f) * m_chunk_scale;
+					d = mirrors->ray_direction;
+					ray_size_bias_chunk = (ray_size_bias + mirrors->path_length * ray_size_coef) * m_chunk_scale;
+					const glm::vec3 reflected_inv_d = 1.0f / d;
+					const glm::vec3 t_window = glm::max((glm::vec3(window_min) - start) * reflected_inv_d, (glm::vec3(window_max + 1) - start) * reflected_inv_d);
+					t_exit = std::min(t_window.x, std::min(t_window.y, t_window.z));
+					const glm::ivec3 reflection_cell = dda.cell;
+					dda = GridDDA(start, d, 0.0f, 0u);
+					if (!isInWindow(dda.cell)) {
+						break;
+					}
+					// Reflections nudged into the next chunk start outside of the reflecting one, which didn't trace them
+					if (dda.cell != reflection_cell) {
+						continue;
+					}
+					if (dda.getExitT() > 1.0f) {
+						dda.t = 1.0f;
+						continue;
+					}
+				}
+			}
+
+			dda.advance();
+			const glm::ivec3& cell = dda.cell;
+			if (cell.x < window_min.x || cell.y < window_min.y || cell.z < window_min.z || cell.x > window_max.x || cell.y > window_max.y || cell.z > window_max.z) {
+				break;
+			}
+		}
+
+		return result;
+	}
+
+	// Only the first ray reaching a chunk requests it, the others see it as empty until it is published
+	void request(ChunkSlot& slot, uint8_t state, const glm::ivec3& coord) const
+	{
+		if (!slot.state.compare_exchange_strong(state, Pending)) {
+			return;
+		}
+		std::lock_guard<std::mutex> lg(m_requests_mutex);
+		m_requests.push_back(coord);
+	}
+
+	// Turns the requests still in the window into tasks, closest to the center first
+	void takeRequests()
+	{
+		m_tasks.clear();
+		{
+			std::lock_guard<std::mutex> lg(m_requests_mutex);
+			m_tasks.swap(m_requests);
+		}
+
+		// The window moved away from these chunks, a ray will request the slot's new chunk.
+		// A chunk still in the slot is kept, rays check its coordinates.
+		m_tasks.erase(std::remove_if(m_tasks.begin(), m_tasks.end(), [this](const glm::ivec3& coord) {
+			if (isInWindow(coord)) {
+				return false;
+			}
+			ChunkSlot& slot = m_slots[getSlotIndex(coord)];
+			slot.state = slot.chunk ? Ready : Unloaded;
+			return true;
+		}), m_tasks.end());
+
+		const glm::ivec3 center = m_center;
+		auto distance = [&center](const glm::ivec3& coord) {
+			const glm::ivec3 v = coord - center;
+			return v.x * v.x + v.y * v.y + v.z * v.z;
+		};
+		std::sort(m_tasks.begin(), m_tasks.end(), [&distance](const glm::ivec3& a, const glm::ivec3& b) {
+			return distance(a) < distance(b);
+		});
+		// Farther chunks stay pending until a later update
+		if (max_chunks_per_update && m_tasks.size() > max_chunks_per_update) {
+			m_requests.assign(m_tasks.begin() + max_chunks_per_update, m_tasks.end());
+			m_tasks.resize(max_chunks_per_update);
+		}
+	}
+
+	// Returns true if any of the published chunks holds voxels
+	bool publishChunks()
+	{
+		bool published = false;
+		const uint32_t task_count = uint32_t(m_tasks.size());
+		for (uint32_t i(0u); i < task_count; ++i) {
+			ChunkSlot& slot = m_slots[getSlotIndex(m_tasks[i])];
+			// Chunks are freed by the next job rather than on the render thread
+			if (!isInWindow(m_tasks[i])) {
+				if (m_results[i]) {
+					m_trash.push_back(std::move(m_results[i]));
+				}
+				slot.state = slot.chunk ? Ready : Unloaded;
+				continue;
+			}
+			if (slot.chunk) {
+				m_trash.push_back(std::move(slot.chunk));
+			}
+			slot.coord = m_tasks[i];
+			slot.chunk = std::move(m_results[i]);
+			slot.state = slot.chunk ? Ready : Empty;
+			published |= slot.state == Ready;
+		}
+		m_results.clear();
+		return published;
+	}
+
+	std::unique_ptr<Chunk> generateChunk(const glm::ivec3& coord) const
+	{
+		// Render space is mirrored so the chunk at coord holds the world chunk m_world_chunks - 1 - coord
+		const glm::ivec3 origin = (glm::ivec3(m_world_chunks - 1) - coord) * int32_t(CHUNK_SIZE);
+		std::unique_ptr<SVO<CHUNK_DEPTH>> svo(new SVO<CHUNK_DEPTH>());
+		generator(*svo, origin);
+
+		std::unique_ptr<Chunk> chunk(new Chunk(*svo));
+		if (chunk->isEmpty()) {
+			chunk.reset();
+		}
+		else if (on_chunk_built) {
+			on_chunk_built(*chunk);
+		}
+		return chunk;
+	}
+};
@@ -0,0 +1,208 @@
+#pragma once
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include "svo.hpp"
+#include "fastnoise/FastNoise.h"
+
+
+// Position is in world voxel coordinates, mirror boxes fill lakes
+struct SolidBox
+{
+	glm::ivec3 position;
+	uint32_t size;
+	bool mirror;
+};
+
+
+// Volumetric terrain defined by a 3D density field, a voxel is solid where the density is positive:
+//   density = (y - surface_y) * gradient + amplitude * noise - cave_amplitude * max(0, cave_noise)
+// Octree nodes are classified coarse to fine using bounds on the density over their volume so noise
+// is only evaluated close to the surface and cave boundaries. Empty voxels below lake_y are mirrors.
+template<uint8_t N>
+struct DensityGenerator
+{
+	static constexpr uint32_t SIZE = 1u << N;
+
+	DensityGenerator()
+		: surface_y(SIZE * 0.5f + 32.0f)
+		, gradient(1.0f / 32.0f)
+		, amplitude(1.0f)
+		, cave_amplitude(0.0f)
+		, lake_y(std::numeric_limits<float>::infinity())
+	{
+		noise.SetNoiseType(FastNoise::SimplexFractal);
+		cave_noise.SetNoiseType(FastNoise::SimplexFractal);
+		cave_noise.SetFractalType(FastNoise::RigidMulti);
+	}
+
+	float getDensity(float x, float y, float z) const
+	{
+		float density = (y - surface_y) * gradient + amplitude * noise.GetNoise(x, y, z);
+		if (cave_amplitude > 0.0f) {
+			density -= cave_amplitude * std::max(0.0f, cave_noise.GetNoise(x, y, z));
+		}
+		return density;
+	}
+
+	// Upper bound of the density's gradient norm
+	float getLipschitzBound() const
+	{
+		const float cave_bound = cave_amplitude > 0.0f ? cave_amplitude * getLipschitzBound(cave_noise) : 0.0f;
+		return gradient + amplitude * getLipschitzBound(noise) + cave_bound;
+	}
+
+	// Fills the SVO of a brick of the world, origin is the position of its first voxel in world voxel coordinates.
+	// Bricks are generated by the streaming workers so they are classified on the calling thread.
+	template<uint8_t B>
+	void generateBrick(SVO<B>& svo, const glm::ivec3& origin) const
+	{
+		std::vector<SolidBox> solids;
+		classify_rec(origin, 1u << B, getLipschitzBound(), solids);
+		// Children are classified in Morton order, solid boxes come out sorted and are inserted in one pass
+		Cell ground;
+		ground.type = Cell::Solid;
+		ground.texture = Cell::Grass;
+		Cell water;
+		water.type = Cell::Mirror;
+		water.texture = Cell::White;
+		std::vector<MortonVoxel> voxels(solids.size());
+		for (uint32_t i(0u); i < solids.size(); ++i) {
+			const glm::uvec3 position(solids[i].position - origin);
+			voxels[i].code = mortonEncode(position.x, position.y, position.z);
+			voxels[i].cell = solids[i].mirror ? water : ground;
+			// Sizes are powers of 2, log2 is read from the float's exponent
+			voxels[i].depth = uint8_t(B + 127u - (floatAsInt(float(solids[i].size)) >> 23u));
+		}
+		svo.insertSorted(voxels);
+	}
+
+	FastNoise noise;
+	FastNoise cave_noise;
+	float surface_y;
+	float gradient;
+	float amplitude;
+	float cave_amplitude;
+	// y grows with depth, infinity disables lakes
+	float lake_y;
+
+private:
+	enum Occupancy
+	{
+		Empty,
+		Solid,
+		Mixed
+	};
+
+	// Bound of the noise's gradient norm derived from the simplex kernel and the octaves' frequencies and amplitudes.
+	// Each simplex corner adds 32 * (0.6 - r^2)^4 * dot(g, d) with |g| = sqrt(2), the norm of its gradient is at most
+	// 32 * sqrt(2) * (0.6 - r^2)^3 * (0.6 + 7 r^2), maximal at r^2 = 3 / 35, and at most 4 corners overlap.
+	// Other noise types get an infinite bound, their nodes are then only decided by the height term.
+	static float getLipschitzBound(const FastNoise& field)
+	{
+		constexpr float SIMPLEX_BOUND = 4.0f * 32.0f * 1.4142136f * 0.1632280f;
+		const float frequency = field.GetFrequency();
+		if (field.GetNoiseType() == FastNoise::Simplex) {
+			return SIMPLEX_BOUND * frequency;
+		}
+		if (field.GetNoiseType() != FastNoise::SimplexFractal) {
+			return std::numeric_limits<float>::infinity();
+		}
+
+		// Octave i is scaled by lacunarity^i and weighted by gain^i
+		float octaves_bound = 0.0f;
+		float amplitude_sum = 0.0f;
+		float octave_amplitude = 1.0f;
+		float octave_frequency = 1.0f;
+		for (int32_t i(0); i < field.GetFractalOctaves(); ++i) {
+			octaves_bound += octave_amplitude * octave_frequency;
+			amplitude_sum += octave_amplitude;
+			octave_amplitude *= field.GetFractalGain();
+			octave_frequency *= field.GetFractalLacunarity();
+		}
+
+		switch (field.GetFractalType()) {
+		case FastNoise::FBM:
+			// Normalized by the sum of the amplitudes
+			return SIMPLEX_BOUND * frequency * octaves_bound / amplitude_sum;
+		case FastNoise::Billow:
+			// abs(n) * 2 - 1 doubles the slopes
+			return 2.0f * SIMPLEX_BOUND * frequency * octaves_bound / amplitude_sum;
+		case FastNoise::RigidMulti:
+			// Not normalized
+			return SIMPLEX_BOUND * frequency * octaves_bound;
+		default:
+			return std::numeric_limits<float>::infinity();
+		}
+	}
+
+	// Densities are sampled at voxel centers, bounds only need to hold between the first and last centers of the node
+	Occupancy classify(const glm::ivec3& position, uint32_t size, float lipschitz) const
+	{
+		const float extent = float(size - 1u);
+		const float x = position.x + 0.5f + 0.5f * extent;
+		const float y = position.y + 0.5f + 0.5f * extent;
+		const float z = position.z + 0.5f + 0.5f * extent;
+		// Noise terms are bounded by [-1, 1], which is often enough far from the surface
+		const float y_min = (position.y + 0.5f - surface_y) * gradient;
+		const float y_max = y_min + extent * gradient;
+		if (y_min - amplitude - cave_amplitude > 0.0f) {
+			return Solid;
+		}
+		if (y_max + amplitude < 0.0f) {
+			return Empty;
+		}
+		// Otherwise bound the variation around the center, single voxels only need the sign at their center
+		const float radius = 0.8660254f * extent;
+		const float spread = (radius > 0.0f) ? lipschitz * radius : 0.0f;
+		const float density = getDensity(x, y, z);
+		if (density - spread > 0.0f) {
+			return Solid;
+		}
+		if (density + spread <= 0.0f) {
+			return Empty;
+		}
+		return Mixed;
+	}
+
+	void classify_rec(const glm::ivec3& position, uint32_t size, float lipschitz, std::vector<SolidBox>& solids) const
+	{
+		const Occupancy occupancy = classify(position, size, lipschitz);
+		if (occupancy == Solid) {
+			solids.push_back({position, size, false});
+			return;
+		}
+		if (occupancy == Empty) {
+			fillLake_rec(position, size, solids);
+			return;
+		}
+		if (size == 1u) {
+			return;
+		}
+
+		const uint32_t sub_size = size >> 1u;
+		for (uint32_t i(0u); i < 8u; ++i) {
+			const glm::ivec3 sub_position = position + int32_t(sub_size) * glm::ivec3(i & 1u, (i >> 1u) & 1u, i >> 2u);
+			classify_rec(sub_position, sub_size, lipschitz, solids);
+		}
+	}
+
+	// Empty nodes only need their voxel centers compared to the lake's level
+	void fillLake_rec(const glm::ivec3& position, uint32_t size, std::vector<SolidBox>& solids) const
+	{
+		if (position.y + 0.5f > lake_y) {
+			solids.push_back({position, size, true});
+			return;
+		}
+		if (position.y + size - 0.5f <= lake_y) {
+			return;
+		}
+
+		const uint32_t sub_size = size >> 1u;
+		for (uint32_t i(0u); i < 8u; ++i) {
+			const glm::ivec3 sub_position = position + int32_t(sub_size) * glm::ivec3(i & 1u, (i >> 1u) & 1u, i >> 2u);
+			fillLake_rec(sub_position, sub_size, solids);
+		}
+	}
+};
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include "lsvo.hpp"
+#include "brick_grid.hpp"
+
+
+// LSVO with a coarse distance field over blocks of 8x8x8 voxels. Each block stores the Chebyshev distance,
+// in blocks, to the nearest block holding voxels so rays jump through empty space with one step per
+// empty cube instead of walking the octree. The octree traversal only starts in the first occupied block.
+// Smaller blocks skip more but the field stops fitting in cache and jumps get slower than octree steps.
+template<uint8_t MAX_DEPTH>
+struct DistanceFieldLSVO : public LSVO<MAX_DEPTH>
+{
+	static constexpr uint8_t BLOCK_DEPTH = 3u;
+	static_assert(MAX_DEPTH > BLOCK_DEPTH, "DistanceFieldLSVO needs at least one octree level above the blocks");
+	static constexpr int32_t FIELD_SIZE = 1 << (MAX_DEPTH - BLOCK_DEPTH);
+	// Distances are capped, farther blocks take more than one jump
+	static constexpr uint8_t MAX_DISTANCE = 31u;
+
+	DistanceFieldLSVO(const SVO<MAX_DEPTH>& svo)
+		: LSVO<MAX_DEPTH>(svo)
+		, m_distances(FIELD_SIZE * FIELD_SIZE * FIELD_SIZE, uint8_t(MAX_DISTANCE))
+	{
+		markOccupied_rec(0u, glm::ivec3(0), FIELD_SIZE);
+		for (uint8_t axis(0u); axis < 3u; ++axis) {
+			computePass(axis, 0u, 1u);
+		}
+	}
+
+	DistanceFieldLSVO(const SVO<MAX_DEPTH>& svo, swrm::Swarm& swarm)
+		: LSVO<MAX_DEPTH>(svo, swarm)
+		, m_distances(FIELD_SIZE * FIELD_SIZE * FIELD_SIZE, uint8_t(MAX_DISTANCE))
+	{
+		markOccupied_rec(0u, glm::ivec3(0), FIELD_SIZE);
+		// Each pass only depends on the previous one, its lines are independent
+		for (uint8_t axis(0u); axis < 3u; ++axis) {
+			swarm.execute([&](uint32_t thread_id, uint32_t max_thread) {
+				computePass(axis, thread_id, max_thread);
+			}).waitExecutionDone();
+		}
+	}
+
+	uint8_t getDistance(const glm::ivec3& block) const
+	{
+		return m_distances[getBlockIndex(block)];
+	}
+
+	HitPoint castRay(const glm::vec3& position, glm::vec3 d, const float ray_size_coef = 0.0f, const float ray_size_bias = 0.0f) const override
+	{
+		constexpr float SVO_SIZE = 1 << MAX_DEPTH;
+		constexpr float BLOCK_SIZE = 1 << BLOCK_DEPTH;
+		constexpr float EPS = 1.0f / float(1 << 23);
+		if (std::abs(d.x) < EPS) { d.x = copysign(EPS, d.x); }
+		if (std::abs(d.y) < EPS) { d.y = copysign(EPS, d.y); }
+		if (std::abs(d.z) < EPS) { d.z = copysign(EPS, d.z); }
+
+		// Jumps are computed in block units
+		const glm::vec3 start = (position - 1.0f) * (SVO_SIZE / BLOCK_SIZE);
+		const glm::vec3 block_d = d * (SVO_SIZE / BLOCK_SIZE);
+		const glm::vec3 inv_d = 1.0f / block_d;
+		const glm::vec3 t_0 = -start * inv_d;
+		const glm::vec3 t_1 = (float(FIELD_SIZE) - start) * inv_d;
+		const glm::vec3 t_near = glm::min(t_0, t_1);
+		const glm::vec3 t_far = glm::max(t_0, t_1);
+		const float t_start = std::max(0.0f, std::max(t_near.x, std::max(t_near.y, t_near.z)));
+		// Same length limit as LSVO
+		const float t_limit = std::min(1.0f, std::min(t_far.x, std::min(t_far.y, t_far.z)));
+		HitPoint result;
+		if (t_start > t_limit) {
+			return result;
+		}
+
+		const glm::ivec3 step(d.x > 0.0f ? 1 : -1, d.y > 0.0f ? 1 : -1, d.z > 0.0f ? 1 : -1);
+		// Blocks are clamped to positive coordinates so truncation gives the same cells as floor
+		glm::ivec3 block = glm::min(glm::max(glm::ivec3(start + t_start * block_d), glm::ivec3(0)), glm::ivec3(FIELD_SIZE - 1));
+		float t = t_start;
+		// Axis through which the current block has been entered
+		uint8_t entry_mask = 0u;
+		bool skipped = false;
+		while (true) {
+			const int32_t distance = getDistance(block);
+			if (!distance) {
+				break;
+			}
+			++result.complexity;
+
+			// All blocks closer than distance are empty, jump to the exit of that cube
+			const glm::ivec3 cube_min = glm::max(block - (distance - 1), glm::ivec3(0));
+			const glm::ivec3 cube_max = glm::min(block + distance, glm::ivec3(FIELD_SIZE));
+			const glm::vec3 t_cube = (glm::vec3(
+				float(step.x > 0 ? cube_max.x : cube_min.x),
+				float(step.y > 0 ? cube_max.y : cube_min.y),
+				float(step.z > 0 ? cube_max.z : cube_min.z)) - start) * inv_d;
+			const uint8_t axis = (t_cube.x <= t_cube.y && t_cube.x <= t_cube.z) ? 0u : (t_cube.y <= t_cube.z ? 1u : 2u);
+			t = t_cube[axis];
+			if (t >= t_limit) {
+				return result;
+			}
+
+			// The ray leaves the cube through one face, on the other axes it is still within the cube's bounds
+			block = glm::min(glm::max(glm::ivec3(start + t * block_d), cube_min), cube_max - 1);
+			block[axis] = step[axis] > 0 ? cube_max[axis] : cube_min[axis] - 1;
+			if (block[axis] < 0 || block[axis] >= FIELD_SIZE) {
+				return result;
+			}
+			entry_mask = uint8_t(1u << axis);
+			skipped = true;
+		}
+
+		if (!skipped) {
+			const uint32_t complexity = result.complexity;
+			result = LSVO<MAX_DEPTH>::castRay(position, d, ray_size_coef, ray_size_bias);
+			result.complexity += complexity;
+			return result;
+		}
+
+		// The footprint of the ray keeps growing from the original position
+		HitPoint hit = LSVO<MAX_DEPTH>::castRay(position + t * d, d, ray_size_coef, ray_size_bias + t * ray_size_coef);
+		hit.complexity += result.complexity;
+		if (!hit.cell || t + hit.distance > 1.0f) {
+			result.complexity = hit.complexity;
+			return result;
+		}
+
+		// A voxel right at the block's boundary is hit before any octree step so it has no normal
+		if (hit.normal == glm::vec3(0.0f) && hit.distance == 0.0f) {
+			setBrickEntryNormal<MAX_DEPTH>(hit, d, entry_mask);
+		}
+		hit.distance += t;
+		return hit;
+	}
+
+private:
+	std::vector<uint8_t> m_distances;
+
+	static uint32_t getBlockIndex(const glm::ivec3& block)
+	{
+		return (block.z * FIELD_SIZE + block.y) * FIELD_SIZE + block.x;
+	}
+
+	// Sets the blocks under the LSVO node to 0, origin and size are in SVO block coordinates
+	void markOccupied_rec(uint32_t node_index, const glm::ivec3& origin, int32_t size)
+	{
+		const LNode& node = this->data[node_index];
+		const int32_t sub_size = size >> 1;
+		for (uint8_t i(0u); i < 8u; ++i) {
+			if (!((node.child_mask >> i) & 1u)) {
+				continue;
+			}
+
+			const glm::ivec3 sub_origin = origin + sub_size * glm::ivec3(i & 1u, (i >> 1u) & 1u, i >> 2u);
+			if (sub_size > 1 && !((node.leaf_mask >> i) & 1u)) {
+				markOccupied_rec(node_index + node.child_offset + i, sub_origin, sub_size);
+				continue;
+			}
+
+			// LSVO mirrors SVO coordinates on all axes
+			const glm::ivec3 render_min = glm::ivec3(FIELD_SIZE - sub_size) - sub_origin;
+			const glm::ivec3 render_max = render_min + sub_size;
+			for (int32_t z(render_min.z); z < render_max.z; ++z) {
+				for (int32_t y(render_min.y); y < render_max.y; ++y) {
+					for (int32_t x(render_min.x); x < render_max.x; ++x) {
+						m_distances[getBlockIndex(glm::ivec3(x, y, z))] = 0u;
+					}
+				}
+			}
+		}
+	}
+
+	// Chebyshev distance is the max of the per axis distances so it is computed with one 1D pass per axis:
+	// after the pass on axis a, a block holds the distance to the nearest occupied block using the axes up to a
+	void computePass(uint8_t axis, uint32_t first_line, uint32_t line_step)
+	{
+		const uint8_t axis_1 = (axis + 1u) % 3u;
+		const uint8_t axis_2 = (axis + 2u) % 3u;
+		const uint32_t line_count = uint32_t(FIELD_SIZE * FIELD_SIZE);
+		uint8_t line[FIELD_SIZE];
+		for (uint32_t line_index(first_line); line_index < line_count; line_index += line_step) {
+			glm::ivec3 block(0);
+			block[axis_1] = int32_t(line_index % uint32_t(FIELD_SIZE));
+			block[axis_2] = int32_t(line_index / uint32_t(FIELD_SIZE));
+			for (int32_t i(0); i < FIELD_SIZE; ++i) {
+				block[axis] = i;
+				line[i] = m_distances[getBlockIndex(block)];
+			}
+
+			for (int32_t i(0); i < FIELD_SIZE; ++i) {
+				// Blocks farther than the current best can't improve it
+				uint8_t best = line[i];
+				for (int32_t offset(1); offset < best; ++offset) {
+					if (i >= offset) {
+						best = std::min(best, std::max(uint8_t(offset), line[i - offset]));
+					}
+					if (i + offset < FIELD_SIZE) {
+						best = std::min(best, std::max(uint8_t(offset), line[i + offset]));
+					}
+				}
+				block[axis] = i;
+				m_distances[getBlockIndex(block)] = best;
+			}
+		}
+	}
+};
@@ -15,6 +15,7 @@ struct EventManager
 		, up(false)
 		, backward(false)
 		, mouse_control(true)
+		, use_heightfield(false)
 	{
 
 	}
@@ -79,6 +80,18 @@ struct EventManager
 				case sf::Keyboard::H:
 					raycaster.use_god_rays = !raycaster.use_god_rays;
 					break;
+				case sf::Keyboard::W:
+					raycaster.use_wavefront = !raycaster.use_wavefront;
+					break;
+				case sf::Keyboard::F:
+					raycaster.use_foveation = !raycaster.use_foveation;
+					break;
+				case sf::Keyboard::T:
+					raycaster.use_dynamic_resolution = !raycaster.use_dynamic_resolution;
+					break;
+				case sf::Keyboard::Y:
+					use_heightfield = !use_heightfield;
+					break;
 				default:
 					break;
 				}
@@ -129,6 +142,8 @@ struct EventManager
 	}
 
 	bool forward, left, right, up, backward, mouse_control;
+	// World generator selection, main regenerates the world when it changes
+	bool use_heightfield;
 
 private:
 	sf::RenderWindow& window;
@@ -0,0 +1,178 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <SFML/Graphics.hpp>
+#include "swarm/swarm.hpp"
+#include "utils.hpp"
+
+
+// Variable rate rendering. The image is split in TILE_SIZE x TILE_SIZE tiles, tiles close to the center keep the
+// full rate checker board, farther ones only render one pixel per 2x2 block (1/4 rate) or per 4x4 block (1/16 rate).
+// The rendered pixel of the blocks moves each frame so the temporal blend still covers every pixel on static views,
+// skipped pixels are interpolated from the neighbor blocks with weights favoring samples of similar depth.
+struct Foveation
+{
+	static constexpr int32_t TILE_SIZE = 4;
+	// Relative depth difference at which a sample's weight is halved
+	static constexpr float DEPTH_TOLERANCE = 1.0f / 32.0f;
+
+	Foveation(const sf::Vector2i& render_size)
+		: size(render_size)
+		, tile_count((render_size.x + TILE_SIZE - 1) / TILE_SIZE, (render_size.y + TILE_SIZE - 1) / TILE_SIZE)
+		, center(0.5f * float(render_size.x), 0.5f * float(render_size.y))
+		, inner_radius(0.25f)
+		, outer_radius(0.5f)
+		, m_rates(tile_count.x * tile_count.y, 1)
+		, m_stamps(render_size.x * render_size.y, 0u)
+		, m_frame(0u)
+	{}
+
+	// Has to be called once per frame before rendering the tiles
+	void update()
+	{
+		++m_frame;
+		const float height = float(size.y);
+		for (int32_t y(0); y < tile_count.y; ++y) {
+			for (int32_t x(0); x < tile_count.x; ++x) {
+				const float dx = (float(x * TILE_SIZE) + 0.5f * TILE_SIZE - center.x) / height;
+				const float dy = (float(y * TILE_SIZE) + 0.5f * TILE_SIZE - center.y) / height;
+				const float distance = std::sqrt(dx * dx + dy * dy);
+				m_rates[y * tile_count.x + x] = (distance < inner_radius) ? 1 : ((distance < outer_radius) ? 2 : 4);
+			}
+		}
+	}
+
+	// Calls render(x, y) on the pixels of the tile to render this frame
+	template<typename Callback>
+	void renderTile(int32_t tile, int32_t checker_board_offset, Callback render)
+	{
+		const int32_t start_x = (tile % tile_count.x) * TILE_SIZE;
+		const int32_t start_y = (tile / tile_count.x) * TILE_SIZE;
+		const int32_t end_x = std::min(start_x + TILE_SIZE, size.x);
+		const int32_t end_y = std::min(start_y + TILE_SIZE, size.y);
+		const int32_t rate = m_rates[tile];
+		if (rate == 1) {
+			for (int32_t y(start_y); y < end_y; ++y) {
+				for (int32_t x(start_x + (y + checker_board_offset) % 2); x < end_x; x += 2) {
+					m_stamps[y * size.x + x] = m_frame;
+					render(x, y);
+				}
+			}
+			return;
+		}
+
+		const sf::Vector2i offset = getSampleOffset(rate);
+		for (int32_t y(start_y + offset.y); y < end_y; y += rate) {
+			for (int32_t x(start_x + offset.x); x < end_x; x += rate) {
+				m_stamps[y * size.x + x] = m_frame;
+				render(x, y);
+			}
+		}
+	}
+
+	// Maps a quality in [0, 1] to the radii, from a 1/4 rate disc around the center to the full rate everywhere
+	void setQuality(float quality)
+	{
+		constexpr float RING_WIDTH = 0.25f;
+		// Distance from the center to the farthest corner
+		const float half_width = std::max(center.x, float(size.x) - center.x) / float(size.y);
+		const float half_height = std::max(center.y, float(size.y) - center.y) / float(size.y);
+		const float max_radius = std::sqrt(half_width * half_width + half_height * half_height);
+		inner_radius = quality * max_radius;
+		outer_radius = inner_radius + RING_WIDTH;
+	}
+
+	// Fills the pixels of reduced rate tiles that were skipped this frame, blending them like rendered ones
+	void upsample(sf::Image& image, std::vector<float>& depths, swrm::Swarm& swarm) const
+	{
+		swarm.execute([&](uint32_t thread_id, uint32_t max_thread) {
+			const int32_t count = tile_count.x * tile_count.y;
+			for (int32_t tile(thread_id); tile < count; tile += max_thread) {
+				if (m_rates[tile] > 1) {
+					upsampleTile(tile, image, depths);
+				}
+			}
+		}).waitExecutionDone();
+	}
+
+	const sf::Vector2i size;
+	const sf::Vector2i tile_count;
+	// Full rate region, in pixels for the center and fractions of the render height for the radii
+	sf::Vector2f center;
+	float inner_radius;
+	float outer_radius;
+
+private:
+	std::vector<int32_t> m_rates;
+	// Frame in which each pixel was last rendered
+	std::vector<uint32_t> m_stamps;
+	uint32_t m_frame;
+
+	// Position of the rendered pixel in each rate x rate block, all positions are visited in rate * rate frames
+	sf::Vector2i getSampleOffset(int32_t rate) const
+	{
+		const int32_t index = int32_t((m_frame * 7u) % uint32_t(rate * rate));
+		return sf::Vector2i(index % rate, index / rate);
+	}
+
+	bool isRendered(int32_t x, int32_t y) const
+	{
+		return x >= 0 && y >= 0 && x < size.x && y < size.y && m_stamps[y * size.x + x] == m_frame;
+	}
+
+	// Tent filter over the samples of the 3x3 surrounding blocks, the depth guide is the sample of the pixel's block
+	void upsampleTile(int32_t tile, sf::Image& image, std::vector<float>& depths) const
+	{
+		constexpr float DEPTH_EPS = 1.0f / 512.0f;
+		const int32_t rate = m_rates[tile];
+		const sf::Vector2i offset = getSampleOffset(rate);
+		const int32_t start_x = (tile % tile_count.x) * TILE_SIZE;
+		const int32_t start_y = (tile / tile_count.x) * TILE_SIZE;
+		const int32_t end_x = std::min(start_x + TILE_SIZE, size.x);
+		const int32_t end_y = std::min(start_y + TILE_SIZE, size.y);
+		for (int32_t y(start_y); y < end_y; ++y) {
+			for (int32_t x(start_x); x < end_x; ++x) {
+				const int32_t block_x = x - x % rate;
+				const int32_t block_y = y - y % rate;
+				if (isRendered(x, y) || !isRendered(block_x + offset.x, block_y + offset.y)) {
+					continue;
+				}
+
+				const float reference_depth = depths[(block_y + offset.y) * size.x + block_x + offset.x];
+				float weight_sum = 0.0f;
+				float r = 0.0f;
+				float g = 0.0f;
+				float b = 0.0f;
+				for (int32_t j(-1); j < 2; ++j) {
+					for (int32_t i(-1); i < 2; ++i) {
+						const int32_t sample_x = block_x + i * rate + offset.x;
+						const int32_t sample_y = block_y + j * rate + offset.y;
+						const float spatial_weight = float(std::max(0, rate - std::abs(x - sample_x)) * std::max(0, rate - std::abs(y - sample_y)));
+						if (!spatial_weight || !isRendered(sample_x, sample_y)) {
+							continue;
+						}
+						const float depth = depths[sample_y * size.x + sample_x];
+						const float depth_difference = std::abs(depth - reference_depth) / (reference_depth + DEPTH_EPS);
+						const float weight = spatial_weight / (1.0f + depth_difference / DEPTH_TOLERANCE);
+						const sf::Color color = image.getPixel(sample_x, sample_y);
+						weight_sum += weight;
+						r += weight * color.r;
+						g += weight * color.g;
+						b += weight * color.b;
+					}
+				}
+
+				// Same persistence as rendered pixels
+				const float old_conservation = 0.4f;
+				sf::Color color(uint8_t(r / weight_sum), uint8_t(g / weight_sum), uint8_t(b / weight_sum));
+				sf::Color old_color = image.getPixel(x, y);
+				mult(old_color, old_conservation);
+				mult(color, 1.0f - old_conservation);
+				add(old_color, color);
+				image.setPixel(x, y, old_color);
+				depths[y * size.x + x] = reference_depth;
+			}
+		}
+	}
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <algorithm>
+#include "utils.hpp"
+
+
+// Drives a quality level in [0, 1] so the measured render times converge to a target.
+// Quality is lowered as soon as the budget is exceeded and raised slowly, a steady frame time is preferred
+// to the best image, and small errors are ignored so the quality doesn't flicker around the target.
+struct FrameTimeController
+{
+	// Weight of the last measure in the average
+	static constexpr float SMOOTHING = 0.25f;
+	// Relative errors smaller than this don't change the quality
+	static constexpr float DEAD_BAND = 0.05f;
+	static constexpr float DOWN_GAIN = 0.5f;
+	static constexpr float UP_GAIN = 0.05f;
+
+	FrameTimeController(float target_time_)
+		: target_time(target_time_)
+		, min_quality(0.0f)
+		, quality(1.0f)
+		, m_average_time(target_time_)
+	{}
+
+	// render_time is in seconds, returns the quality for the next frame
+	float update(float render_time)
+	{
+		m_average_time += SMOOTHING * (render_time - m_average_time);
+		// A spike over the budget is reacted to without waiting for the average to catch up
+		const float time = std::max(render_time, m_average_time);
+		const float error = (target_time - time) / target_time;
+		if (error < -DEAD_BAND) {
+			quality += DOWN_GAIN * error;
+		}
+		else if (error > DEAD_BAND) {
+			quality += UP_GAIN * error;
+		}
+		clamp(quality, min_quality, 1.0f);
+		return quality;
+	}
+
+	float target_time;
+	float min_quality;
+	float quality;
+
+private:
+	float m_average_time;
+};
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <limits>
+#include <SFML/Graphics.hpp>
+#include "volumetric.hpp"
+#include "utils.hpp"
+
+
+// Orthographic shadow map of the static world along the light direction, seen from the center of the [1, 2] volume.
+// Texels are computed lazily when sampled and store the distance from the light plane to the first occluder with
+// the generation they were computed in, so invalidating the cache is free and only sampled texels are recomputed.
+struct LightVisibilityCache
+{
+	LightVisibilityCache(uint32_t resolution_)
+		: resolution(resolution_)
+		, m_texels(new std::atomic<uint64_t>[resolution_ * resolution_])
+		, m_center(1.5f)
+		, m_radius(0.8660254f)
+		, m_generation(1u)
+		, m_budget(0)
+		, m_direction(0.0f)
+	{
+		for (uint32_t i(resolution * resolution); i--;) {
+			m_texels[i].store(0u, std::memory_order_relaxed);
+		}
+	}
+
+	// The light is considered directional, the cache is only invalidated if its direction changes
+	void setLight(const glm::vec3& light_position)
+	{
+		const glm::vec3 direction = glm::normalize(light_position - m_center);
+		if (direction == m_direction) {
+			return;
+		}
+		m_direction = direction;
+		// Any vector not colinear to the direction gives the plane's basis
+		const glm::vec3 up = std::abs(direction.y) < 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+		m_u = glm::normalize(glm::cross(up, direction));
+		m_v = glm::cross(direction, m_u);
+		invalidate();
+	}
+
+	// Volume the map covers, it is re-centered and invalidated when the bounds change.
+	// Points outside of it are considered lit.
+	void setBounds(const glm::vec3& min, const glm::vec3& max)
+	{
+		const glm::vec3 center = 0.5f * (min + max);
+		const float radius = 0.5f * glm::length(max - min);
+		if (center == m_center && radius == m_radius) {
+			return;
+		}
+		m_center = center;
+		m_radius = radius;
+		invalidate();
+	}
+
+	// Has to be called when the static world changes
+	void invalidate()
+	{
+		++m_generation;
+	}
+
+	// Maximum number of texels computed until the next call, stale texels are used once it is reached
+	void setBudget(int32_t budget)
+	{
+		m_budget.store(budget, std::memory_order_relaxed);
+	}
+
+	// Points never computed are considered lit when the budget is exhausted
+	bool isLit(const Volumetric& world, const glm::vec3& point)
+	{
+		constexpr float BIAS = 2.0f / 512.0f;
+		const glm::vec3 relative = point - m_center;
+		const int32_t x = int32_t((glm::dot(relative, m_u) / m_radius * 0.5f + 0.5f) * resolution);
+		const int32_t y = int32_t((glm::dot(relative, m_v) / m_radius * 0.5f + 0.5f) * resolution);
+		if (x < 0 || y < 0 || x >= int32_t(resolution) || y >= int32_t(resolution)) {
+			return true;
+		}
+
+		std::atomic<uint64_t>& texel = m_texels[y * resolution + x];
+		uint64_t value = texel.load(std::memory_order_relaxed);
+		const uint32_t generation = m_generation;
+		const uint32_t texel_generation = uint32_t(value >> 32u);
+		if (texel_generation != generation && m_budget.fetch_sub(1, std::memory_order_relaxed) > 0) {
+			value = (uint64_t(generation) << 32u) | floatAsInt(computeOccluderDistance(world, x, y));
+			texel.store(value, std::memory_order_relaxed);
+		}
+		else if (!texel_generation) {
+			return true;
+		}
+
+		const float point_distance = m_radius - glm::dot(relative, m_direction);
+		return point_distance <= intAsFloat(uint32_t(value)) + BIAS;
+	}
+
+	const uint32_t resolution;
+
+private:
+	std::unique_ptr<std::atomic<uint64_t>[]> m_texels;
+	// The light plane is tangent to the sphere bounding the volume, [1, 2] until setBounds is called
+	glm::vec3 m_center;
+	float m_radius;
+	uint32_t m_generation;
+	std::atomic<int32_t> m_budget;
+	glm::vec3 m_direction;
+	glm::vec3 m_u;
+	glm::vec3 m_v;
+
+	float computeOccluderDistance(const Volumetric& world, int32_t x, int32_t y) const
+	{
+		const float u = ((float(x) + 0.5f) / resolution * 2.0f - 1.0f) * m_radius;
+		const float v = ((float(y) + 0.5f) / resolution * 2.0f - 1.0f) * m_radius;
+		const glm::vec3 start = m_center + u * m_u + v * m_v + m_radius * m_direction;
+		const HitPoint hit = world.castRay(start, -m_direction);
+		return hit.cell ? hit.distance : std::numeric_limits<float>::max();
+	}
+};
+
+
+// Light scattered toward the camera along primary rays. Rays are marched at 1 / SCALE of the render resolution
+// against the visibility cache, neighbor texels start their steps at interleaved offsets and the result is
+// upsampled with weights favoring texels of similar depth so it doesn't bleed over silhouettes.
+struct GodRays
+{
+	static constexpr int32_t SCALE = 4;
+	static constexpr uint32_t STEP_COUNT = 16u;
+	static constexpr uint32_t PATTERN_SIZE = 4u;
+	// Used for the sky and the march's length limit, in render space
+	static constexpr float MAX_DISTANCE = 0.5f;
+
+	GodRays(const sf::Vector2i& render_size)
+		: size((render_size.x + SCALE - 1) / SCALE, (render_size.y + SCALE - 1) / SCALE)
+		, light_cache(1024u)
+		, density(1.0f)
+		, frame(0u)
+		, m_scattering(size.x * size.y, 0.0f)
+		, m_depths(size.x * size.y, float(MAX_DISTANCE))
+	{}
+
+	// Full resolution pixel whose ray and depth are used for the texel
+	sf::Vector2i getSamplePixel(const sf::Vector2i& texel) const
+	{
+		return sf::Vector2i(texel.x * SCALE + SCALE / 2, texel.y * SCALE + SCALE / 2);
+	}
+
+	// depth is the distance of the primary hit, 0 for the sky
+	void march(const Volumetric& world, const sf::Vector2i& texel, const glm::vec3& start, const glm::vec3& direction, float depth)
+	{
+		const float length = (depth > 0.0f) ? std::min(depth, float(MAX_DISTANCE)) : MAX_DISTANCE;
+		const float step = length / float(STEP_COUNT);
+		// Each texel of a PATTERN_SIZE x PATTERN_SIZE tile and each frame get a different start offset
+		const uint32_t pattern_index = (texel.x % PATTERN_SIZE) + PATTERN_SIZE * (texel.y % PATTERN_SIZE);
+		const float offset = frac((float(pattern_index) + 0.618034f * float(frame)) / float(PATTERN_SIZE * PATTERN_SIZE));
+		uint32_t lit_count = 0u;
+		for (uint32_t i(0u); i < STEP_COUNT; ++i) {
+			lit_count += light_cache.isLit(world, start + ((float(i) + offset) * step) * direction);
+		}
+
+		const uint32_t index = texel.y * size.x + texel.x;
+		m_scattering[index] = 1.0f - std::exp(-density * step * float(lit_count));
+		m_depths[index] = length;
+	}
+
+	// Joint bilateral upsampling of the 4 closest texels
+	float getScattering(const sf::Vector2i& pixel, float depth) const
+	{
+		constexpr float DEPTH_EPS = 1.0f / 512.0f;
+		const float pixel_depth = (depth > 0.0f) ? std::min(depth, float(MAX_DISTANCE)) : MAX_DISTANCE;
+		const float fx = (float(pixel.x) + 0.5f) / float(SCALE) - 0.5f;
+		const float fy = (float(pixel.y) + 0.5f) / float(SCALE) - 0.5f;
+		const int32_t x0 = std::max(0, std::min(int32_t(fx), size.x - 1));
+		const int32_t y0 = std::max(0, std::min(int32_t(fy), size.y - 1));
+		const int32_t x1 = std::min(x0 + 1, size.x - 1);
+		const int32_t y1 = std::min(y0 + 1, size.y - 1);
+		const float tx = std::max(0.0f, std::min(1.0f, fx - float(x0)));
+		const float ty = std::max(0.0f, std::min(1.0f, fy - float(y0)));
+
+		float weight_sum = 0.0f;
+		float scattering = 0.0f;
+		const int32_t xs[2] = {x0, x1};
+		const int32_t ys[2] = {y0, y1};
+		for (uint8_t i(0u); i < 4u; ++i) {
+			const uint32_t index = ys[i >> 1u] * size.x + xs[i & 1u];
+			const float spatial_weight = ((i & 1u) ? tx : 1.0f - tx) * ((i >> 1u) ? ty : 1.0f - ty);
+			const float weight = (spatial_weight + 0.001f) / (DEPTH_EPS + std::abs(m_depths[index] - pixel_depth));
+			weight_sum += weight;
+			scattering += weight * m_scattering[index];
+		}
+
+		return scattering / weight_sum;
+	}
+
+	const sf::Vector2i size;
+	LightVisibilityCache light_cache;
+	// Scattering coefficient of the air per render space unit
+	float density;
+	// Rotates the interleaved offsets, incremented once per frame
+	uint32_t frame;
+
+private:
+	std::vector<float> m_scattering;
+	std::vector<float> m_depths;
+};
@@ -2,137 +2,198 @@
 
 #include <stdint.h>
 #include "volumetric.hpp"
-#include <array>
+#include <vector>
+#include <unordered_map>
 #include "cell.hpp"
 #include "utils.hpp"
 
 
+// Dense grid storing 1 bit per voxel, bits are packed in 4x4x4 bricks of one 64 bits word each
+// so empty bricks are skipped with a single load. Materials are kept in a sparse map, voxels
+// without entry use default_cell. Works in voxel space, the grid spans [0, X) x [0, Y) x [0, Z).
 template<int32_t X, int32_t Y, int32_t Z>
 class Grid3D : public Volumetric
 {
 public:
+	static constexpr int32_t BRICK_SHIFT = 2;
+	static constexpr int32_t BRICK_X = (X + 3) >> BRICK_SHIFT;
+	static constexpr int32_t BRICK_Y = (Y + 3) >> BRICK_SHIFT;
+	static constexpr int32_t BRICK_Z = (Z + 3) >> BRICK_SHIFT;
+
 	Grid3D();
 
-	HitPoint castRay(const glm::vec3& position, const glm::vec3& direction) const override;
+	HitPoint castRay(const glm::vec3& position, glm::vec3 direction, const float ray_size_coef = 0.0f, const float ray_size_bias = 0.0f) const override;
 
-	void setCell(Cell::Type type, uint32_t x, uint32_t y, uint32_t z);
+	void setCell(Cell::Type type, Cell::Texture texture, uint32_t x, uint32_t y, uint32_t z) override;
+
+	void setCell(Cell::Type type, uint32_t x, uint32_t y, uint32_t z)
+	{
+		setCell(type, default_cell.texture, x, y, z);
+	}
+
+	bool isOccupied(int32_t x, int32_t y, int32_t z) const
+	{
+		return (m_bricks[getBrickIndex(x, y, z)] >> getBitIndex(x, y, z)) & 1u;
+	}
 
 	const Cell& getCellAt(const glm::vec3& position) const
 	{
-		return m_cells[int(position.x)][int(position.y)][int(position.z)];
+		const int32_t x = int32_t(position.x);
+		const int32_t y = int32_t(position.y);
+		const int32_t z = int32_t(position.z);
+		return isOccupied(x, y, z) ? getMaterial(x, y, z) : m_empty_cell;
 	}
 
+	// Cell used for voxels without a specific material
+	Cell default_cell;
+
 private:
-	std::array<std::array<std::array<Cell, Z>, Y>, X> m_cells;
+	std::vector<uint64_t> m_bricks;
+	std::unordered_map<uint32_t, Cell> m_materials;
+	Cell m_empty_cell;
+
+	static uint32_t getBrickIndex(int32_t x, int32_t y, int32_t z)
+	{
+		return ((x >> BRICK_SHIFT) * BRICK_Y + (y >> BRICK_SHIFT)) * BRICK_Z + (z >> BRICK_SHIFT);
+	}
+
+	static uint32_t getBitIndex(int32_t x, int32_t y, int32_t z)
+	{
+		return (x & 3) | ((y & 3) << 2) | ((z & 3) << 4);
+	}
+
+	static uint32_t getVoxelIndex(int32_t x, int32_t y, int32_t z)
+	{
+		return (x * Y + y) * Z + z;
+	}
+
+	const Cell& getMaterial(int32_t x, int32_t y, int32_t z) const
+	{
+		const auto it = m_materials.find(getVoxelIndex(x, y, z));
+		return it == m_materials.end() ? default_cell : it->second;
+	}
 };
 
 template<int32_t X, int32_t Y, int32_t Z>
 inline Grid3D<X, Y, Z>::Grid3D()
+	: m_bricks(BRICK_X * BRICK_Y * BRICK_Z, 0u)
 {
-	constexpr uint64_t size = X * Y * Z;
+	default_cell.type = Cell::Solid;
+	default_cell.texture = Cell::Grass;
+	m_empty_cell.type = Cell::Empty;
+	m_empty_cell.texture = Cell::None;
 }
 
 template<int32_t X, int32_t Y, int32_t Z>
-inline HitPoint Grid3D<X, Y, Z>::castRay(const glm::vec3& position, const glm::vec3& direction) const
+inline HitPoint Grid3D<X, Y, Z>::castRay(const glm::vec3& position, glm::vec3 direction, const float ray_size_coef, const float ray_size_bias) const
 {
 	HitPoint point;
 
-	// Compute how much (in units of t) we can move along the ray
-	// before reaching the cell's width and height
-	const float t_dx = std::abs(1.0f / direction.x);
-	const float t_dy = std::abs(1.0f / direction.y);
-	const float t_dz = std::abs(1.0f / direction.z);
-
-	// step_x and step_y describe if cell_x and cell_y
-	// are incremented or decremented during iterations
-	const int32_t step_x = direction.x < 0 ? -1 : 1;
-	const int32_t step_y = direction.y < 0 ? -1 : 1;
-	const int32_t step_z = direction.z < 0 ? -1 : 1;
-
-	// Compute the value of t for first intersection in x and y
-	const int32_t dir_x = step_x > 0 ? 1 : 0;
-	const int32_t dir_y = step_y > 0 ? 1 : 0;
-	const int32_t dir_z = step_z > 0 ? 1 : 0;
+	constexpr float EPS = 1.0f / float(1 << 23);
+	if (std::abs(direction.x) < EPS) { direction.x = copysign(EPS, direction.x); }
+	if (std::abs(direction.y) < EPS) { direction.y = copysign(EPS, direction.y); }
+	if (std::abs(direction.z) < EPS) { direction.z = copysign(EPS, direction.z); }
+
+	// Clip the ray to the grid
+	const glm::vec3 inv_direction = 1.0f / direction;
+	const glm::vec3 grid_size = glm::vec3(X, Y, Z);
+	const glm::vec3 t_0 = -position * inv_direction;
+	const glm::vec3 t_1 = (grid_size - position) * inv_direction;
+	const glm::vec3 t_near = glm::min(t_0, t_1);
+	const glm::vec3 t_far = glm::max(t_0, t_1);
+	float t = std::max(0.0f, std::max(t_near.x, std::max(t_near.y, t_near.z)));
+	const float t_exit = std::min(t_far.x, std::min(t_far.y, t_far.z));
+	if (t > t_exit) {
+		return point;
+	}
 
-	// cell_x and cell_y are the starting voxel's coordinates
-	int32_t cell_x = position.x;
-	int32_t cell_y = position.y;
-	int32_t cell_z = position.z;
+	// step describes if cell coordinates are incremented or decremented during iterations
+	const glm::ivec3 step(direction.x < 0 ? -1 : 1, direction.y < 0 ? -1 : 1, direction.z < 0 ? -1 : 1);
+	const glm::ivec3 grid_max(X - 1, Y - 1, Z - 1);
 
-	float t_max_x = ((cell_x + dir_x) - position.x) / direction.x;
-	float t_max_y = ((cell_y + dir_y) - position.y) / direction.y;
-	float t_max_z = ((cell_z + dir_z) - position.z) / direction.z;
+	// Side through which the current cell has been entered, -1 if the ray starts inside
+	int8_t hit_side = -1;
+	if (t > 0.0f) {
+		hit_side = (t_near.x >= t_near.y && t_near.x >= t_near.z) ? 0 : (t_near.y >= t_near.z ? 1 : 2);
+	}
 
-	uint8_t hit_side;
+	glm::ivec3 cell(glm::floor(position + t * direction));
+	cell = glm::ivec3(std::min(std::max(cell.x, 0), grid_max.x), std::min(std::max(cell.y, 0), grid_max.y), std::min(std::max(cell.z, 0), grid_max.z));
 
-	const uint32_t max_iter = 2048;
+	// Empty bricks are crossed in one step, occupied ones voxel by voxel
 	uint32_t iter = 0U;
-	while (cell_x >= 0 && cell_y >= 0 && cell_z >= 0 && cell_x < X && cell_y < Y && cell_z < Z && iter < max_iter) {
-		float t_max_min;
+	while (true) {
 		++iter;
-		if (t_max_x < t_max_y) {
-			if (t_max_x < t_max_z) {
-				t_max_min = t_max_x;
-				t_max_x += t_dx;
-				cell_x += step_x;
-				hit_side = 0;
-			}
-			else {
-				t_max_min = t_max_z;
-				t_max_z += t_dz;
-				cell_z += step_z;
-				hit_side = 2;
+		const uint64_t brick = m_bricks[getBrickIndex(cell.x, cell.y, cell.z)];
+		const int32_t shift = brick ? 0 : BRICK_SHIFT;
+		if ((brick >> getBitIndex(cell.x, cell.y, cell.z)) & 1u) {
+			const glm::vec3 hit = position + t * direction;
+			point.cell = &getMaterial(cell.x, cell.y, cell.z);
+			point.position = hit;
+			point.normal = glm::vec3(0.0f);
+
+			if (hit_side == 0) {
+				point.normal = glm::vec3(-step.x, 0.0f, 0.0f);
+				point.voxel_coord = glm::vec2(1.0f - frac(hit.z), frac(hit.y));
+			} else if (hit_side == 1) {
+				point.normal = glm::vec3(0.0f, -step.y, 0.0f);
+				point.voxel_coord = glm::vec2(frac(hit.x), frac(hit.z));
+			} else if (hit_side == 2) {
+				point.normal = glm::vec3(0.0f, 0.0f, -step.z);
+				point.voxel_coord = glm::vec2(frac(hit.x), frac(hit.y));
 			}
+
+			point.distance = t;
+			point.complexity = iter;
+			return point;
 		}
-		else {
-			if (t_max_y < t_max_z) {
-				t_max_min = t_max_y;
-				t_max_y += t_dy;
-				cell_y += step_y;
-				hit_side = 1;
-			}
-			else {
-				t_max_min = t_max_z;
-				t_max_z += t_dz;
-				cell_z += step_z;
-				hit_side = 2;
-			}
+
+		// Exit the current voxel or empty brick
+		const glm::ivec3 cell_min((cell.x >> shift) << shift, (cell.y >> shift) << shift, (cell.z >> shift) << shift);
+		const glm::ivec3 cell_max = cell_min + (1 << shift);
+		const glm::vec3 t_max = (glm::vec3(
+			float(step.x > 0 ? cell_max.x : cell_min.x),
+			float(step.y > 0 ? cell_max.y : cell_min.y),
+			float(step.z > 0 ? cell_max.z : cell_min.z)) - position) * inv_direction;
+		hit_side = (t_max.x <= t_max.y && t_max.x <= t_max.z) ? 0 : (t_max.y <= t_max.z ? 1 : 2);
+		t = t_max[hit_side];
+		if (t > t_exit) {
+			break;
 		}
 
-		if (cell_x >= 0 && cell_y >= 0 && cell_z >= 0 && cell_x < X && cell_y < Y && cell_z < Z) {
-			const Cell& cell = m_cells[cell_x][cell_y][cell_z];
-			if (cell.type != Cell::Empty) {
-				float hit_x = position.x + t_max_min * direction.x;
-				float hit_y = position.y + t_max_min * direction.y;
-				float hit_z = position.z + t_max_min * direction.z;
-
-				point.cell = &cell;
-				point.position = glm::vec3(hit_x, hit_y, hit_z);
-
-				if (hit_side == 0) {
-					point.normal = glm::vec3(-step_x, 0.0f, 0.0f);
-					point.voxel_coord = glm::vec2(1.0f-frac(hit_z), frac(hit_y));
-				} else if (hit_side == 1) {
-					point.normal = glm::vec3(0.0f, -step_y, 0.0f);
-					point.voxel_coord = glm::vec2(frac(hit_x), frac(hit_z));
-				}else if (hit_side == 2) {
-					point.normal = glm::vec3(0.0f, 0.0f, -step_z);
-					point.voxel_coord = glm::vec2(frac(hit_x), frac(hit_y));
-				}
-
-				point.distance = t_max_min;
-				point.complexity = iter;
-
-				break;
-			}
+		// On the other axes the ray is still within the bounds of the cell it leaves
+		const glm::ivec3 next(glm::floor(position + t * direction));
+		const glm::ivec3 cell_last = cell_max - 1;
+		cell = glm::ivec3(std::min(std::max(next.x, cell_min.x), cell_last.x), std::min(std::max(next.y, cell_min.y), cell_last.y), std::min(std::max(next.z, cell_min.z), cell_last.z));
+		cell[hit_side] = step[hit_side] > 0 ? cell_max[hit_side] : cell_min[hit_side] - 1;
+		if (cell[hit_side] < 0 || cell[hit_side] > grid_max[hit_side]) {
+			break;
 		}
 	}
 
+	point.complexity = iter;
 	return point;
 }
 
 template<int32_t X, int32_t Y, int32_t Z>
-inline void Grid3D<X, Y, Z>::setCell(Cell::Type type, uint32_t x, uint32_t y, uint32_t z)
+inline void Grid3D<X, Y, Z>::setCell(Cell::Type type, Cell::Texture texture, uint32_t x, uint32_t y, uint32_t z)
 {
-	m_cells[x][y][z].type = type;
+	uint64_t& brick = m_bricks[getBrickIndex(x, y, z)];
+	const uint64_t mask = uint64_t(1u) << getBitIndex(x, y, z);
+	const uint32_t index = getVoxelIndex(x, y, z);
+	if (type == Cell::Empty) {
+		brick &= ~mask;
+		m_materials.erase(index);
+		return;
+	}
+
+	brick |= mask;
+	if (type != default_cell.type || texture != default_cell.texture) {
+		Cell& cell = m_materials[index];
+		cell.type = type;
+		cell.texture = texture;
+	}
+	else {
+		m_materials.erase(index);
+	}
 }
@@ -15,12 +15,47 @@ struct LSVO : public Volumetric
 		raw_data = &(data[0]);
 	}
 
+	LSVO(const SVO<MAX_DEPTH>& svo, swrm::Swarm& swarm)
+	{
+		importFromSVO(svo, swarm);
+		raw_data = &(data[0]);
+	}
+
 	void importFromSVO(const SVO<MAX_DEPTH>& svo)
 	{
 		data = compileSVO(svo);
-		cell = new Cell();
-		cell->type = Cell::Type::Solid;
-		cell->texture = Cell::Texture::Grass;
+	}
+
+	void importFromSVO(const SVO<MAX_DEPTH>& svo, swrm::Swarm& swarm)
+	{
+		data = compileSVO(svo, swarm);
+	}
+
+	// Bakes the ambient occlusion of the faces of voxel sized leaves, it is then returned with hits
+	void bakeOcclusion()
+	{
+		OccupancyGrid grid(MAX_DEPTH);
+		std::vector<VoxelLeaf> leaves;
+		collectLeaves_rec(data, 0U, glm::ivec3(0), 1 << MAX_DEPTH, grid, leaves);
+		occlusion.reset(leaves, uint32_t(data.size()));
+		::bakeOcclusion(grid, leaves, occlusion, 0U, 1U);
+	}
+
+	void bakeOcclusion(swrm::Swarm& swarm)
+	{
+		OccupancyGrid grid(MAX_DEPTH);
+		std::vector<VoxelLeaf> leaves;
+		collectLeaves_rec(data, 0U, glm::ivec3(0), 1 << MAX_DEPTH, grid, leaves);
+		occlusion.reset(leaves, uint32_t(data.size()));
+		// Leaves only write their own entry
+		swarm.execute([&](uint32_t thread_id, uint32_t max_thread) {
+			::bakeOcclusion(grid, leaves, occlusion, thread_id, max_thread);
+		}).waitExecutionDone();
+	}
+
+	bool isEmpty() const
+	{
+		return !data[0].child_mask;
 	}
 
 	void setCell(Cell::Type type, Cell::Texture texture, uint32_t x, uint32_t y, uint32_t z) {}
@@ -30,30 +65,74 @@ struct LSVO : public Volumetric
 		return planes_pos * inv_direction - offset;
 	}
 
+	// What a leaf handler of castRayThroughLeaves decided for the leaf the ray entered
+	enum LeafAction
+	{
+		// Regular LSVO hit on the leaf
+		AcceptLeaf,
+		// The handler filled the hit itself, it is returned as is
+		ReturnHit,
+		// The ray goes on past the leaf as if it was empty
+		SkipLeaf
+	};
+
+	// Leaf reached by the traversal, min and size give its bounds in render space, t_min and t_max the ray's span in it
+	struct LeafEntry
+	{
+		glm::vec3 min;
+		float size;
+		float t_min;
+		float t_max;
+		// Step mask of the face the ray entered through, 0 if it started inside
+		uint8_t normal;
+	};
+
 	HitPoint castRay(const glm::vec3& position, glm::vec3 d, const float ray_size_coef = 0.0f, const float ray_size_bias = 0.0f) const override
+	{
+		return castRayThroughLeaves(position, d, ray_size_coef, ray_size_bias, [](const LeafEntry&, HitPoint&) {
+			return AcceptLeaf;
+		});
+	}
+
+	// Reflections resume the traversal next to the mirror instead of starting again from the root
+	HitPoint castMirroredRay(glm::vec3 position, glm::vec3 d, float ray_size_coef, float ray_size_bias, MirrorHandler& mirrors) const override
+	{
+		return castRayThroughLeaves(position, d, ray_size_coef, ray_size_bias, [](const LeafEntry&, HitPoint&) {
+			return AcceptLeaf;
+		}, [&](const HitPoint& hit, glm::vec3& start, glm::vec3& direction) {
+			return hit.cell->type == Cell::Mirror && hit.normal != glm::vec3(0.0f) && mirrors.onMirrorHit(hit, start, direction);
+		});
+	}
+
+	// castRay where on_leaf(const LeafEntry&, HitPoint&) decides what happens when a leaf is reached, volumes storing
+	// data under the leaves can continue their traversal there and resume this one, with its stack, on miss
+	template<typename LeafHandler>
+	HitPoint castRayThroughLeaves(const glm::vec3& position, glm::vec3 d, const float ray_size_coef, const float ray_size_bias, LeafHandler on_leaf) const
+	{
+		return castRayThroughLeaves(position, d, ray_size_coef, ray_size_bias, on_leaf, [](const HitPoint&, glm::vec3&, glm::vec3&) {
+			return false;
+		});
+	}
+
+	// Same with on_hit(const HitPoint&, glm::vec3& start, glm::vec3& d) called on each hit, it returns true if the ray
+	// bounces and then sets start and d to the reflected ray. start must be outside of the hit cube, the traversal goes
+	// up the stack to the deepest node holding it and resumes from there. Distances are from the last start.
+	template<typename LeafHandler, typename HitHandler>
+	HitPoint castRayThroughLeaves(glm::vec3 position, glm::vec3 d, const float ray_size_coef, float ray_size_bias, LeafHandler on_leaf, HitHandler on_hit) const
 	{
 		HitPoint result;
 		// Const values
 		constexpr uint8_t SVO_MAX_DEPTH = 23u;
 		constexpr uint8_t DEPTH_OFFSET = SVO_MAX_DEPTH - MAX_DEPTH;
-		constexpr float SVO_SIZE = 1 << MAX_DEPTH;
-		constexpr float EPS = 1.0f / float(1 << SVO_MAX_DEPTH);
-		// Initialize stack
+		// Initialize stack, every descent is pushed so it always holds all the ancestors for reflections
 		OctreeStack stack[MAX_DEPTH + 1u];
-		// Check octant mask and modify ray accordingly
-		if (std::abs(d.x) < EPS) { d.x = copysign(EPS, d.x); }
-		if (std::abs(d.y) < EPS) { d.y = copysign(EPS, d.y); }
-		if (std::abs(d.z) < EPS) { d.z = copysign(EPS, d.z); }
-		const glm::vec3 t_coef = -1.0f / glm::abs(d);
-		glm::vec3 t_offset = position * t_coef;
-		uint8_t mirror_mask = 7u;
-		if (d.x > 0.0f) { mirror_mask ^= 1u, t_offset.x = 3.0f * t_coef.x - t_offset.x; }
-		if (d.y > 0.0f) { mirror_mask ^= 2u, t_offset.y = 3.0f * t_coef.y - t_offset.y; }
-		if (d.z > 0.0f) { mirror_mask ^= 4u, t_offset.z = 3.0f * t_coef.z - t_offset.z; }
+		glm::vec3 t_coef;
+		glm::vec3 t_offset;
+		uint8_t mirror_mask;
+		setupRay(position, d, t_coef, t_offset, mirror_mask);
 		// Initialize t_span
 		float t_min = std::max(2.0f * t_coef.x - t_offset.x, std::max(2.0f * t_coef.y - t_offset.y, 2.0f * t_coef.z - t_offset.z));
 		float t_max = std::min(t_coef.x - t_offset.x, std::min(t_coef.y - t_offset.y, t_coef.z - t_offset.z));
-		float h = t_max;
 		t_min = std::max(0.0f, t_min);
 		t_max = std::min(1.0f, t_max);
 		// Init current voxel
@@ -67,108 +146,218 @@ struct LSVO : public Volumetric
 		if (1.5f * t_coef.y - t_offset.y > t_min) { child_offset ^= 2u, pos.y = 1.5f; }
 		if (1.5f * t_coef.z - t_offset.z > t_min) { child_offset ^= 4u, pos.z = 1.5f; }
 		uint8_t normal = 0u;
-		uint16_t child_infos = 0u;
-		// Explore octree
-		while (scale < SVO_MAX_DEPTH && scale > MAX_DEPTH) {
-			++result.complexity;
-			const LNode& parent_ref = raw_data[parent_id];
-			// Compute new T span
-			const glm::vec3 t_corner(pos.x * t_coef.x - t_offset.x, pos.y * t_coef.y - t_offset.y, pos.z * t_coef.z - t_offset.z);
-			const float tc_max = std::min(t_corner.x, std::min(t_corner.y, t_corner.z));
-			// Check if child exists here
-			const uint8_t child_shift = child_offset ^ mirror_mask;
-			const uint8_t child_mask = parent_ref.child_mask >> child_shift;
-			if ((child_mask & 1u) && t_min <= t_max) {
-				if (tc_max * ray_size_coef + ray_size_bias >= scale_f) {
-					result.cell = cell;
-					break;
-				}
-				const float tv_max = std::min(t_max, tc_max);
-				const float half = scale_f * 0.5f;
-				const glm::vec3 t_half = half * t_coef + t_corner;
-				if (t_min <= tv_max) {
-					const uint8_t leaf_mask = parent_ref.leaf_mask >> child_shift;
-					// We hit a leaf
-					if (leaf_mask & 1u) {
-						result.cell = cell;
+		// Slot of the hit leaf, the root is never a leaf
+		uint32_t leaf_slot = 0u;
+		while (true) {
+			// Explore octree
+			while (scale < SVO_MAX_DEPTH && scale > MAX_DEPTH) {
+				++result.complexity;
+				const LNode& parent_ref = raw_data[parent_id];
+				// Compute new T span
+				const glm::vec3 t_corner(pos.x * t_coef.x - t_offset.x, pos.y * t_coef.y - t_offset.y, pos.z * t_coef.z - t_offset.z);
+				const float tc_max = std::min(t_corner.x, std::min(t_corner.y, t_corner.z));
+				// Check if child exists here
+				const uint8_t child_shift = child_offset ^ mirror_mask;
+				const uint8_t child_mask = parent_ref.child_mask >> child_shift;
+				if ((child_mask & 1u) && t_min <= t_max) {
+					if (tc_max * ray_size_coef + ray_size_bias >= scale_f) {
+						result.cell = decodeCell(raw_data[parent_id + parent_ref.child_offset + child_shift].color);
 						break;
 					}
-					// Eventually add parent to the stack
-					if (tc_max < h) {
-						stack[scale - DEPTH_OFFSET].parent_index = parent_id;
-						stack[scale - DEPTH_OFFSET].t_max = t_max;
+					const float tv_max = std::min(t_max, tc_max);
+					const float half = scale_f * 0.5f;
+					const glm::vec3 t_half = half * t_coef + t_corner;
+					if (t_min <= tv_max) {
+						const uint8_t leaf_mask = parent_ref.leaf_mask >> child_shift;
+						// We hit a leaf
+						if (leaf_mask & 1u) {
+							LeafEntry leaf;
+							leaf.min = getMirroredMin(pos, scale_f, mirror_mask);
+							leaf.size = scale_f;
+							leaf.t_min = t_min;
+							leaf.t_max = tv_max;
+							leaf.normal = normal;
+							const LeafAction action = on_leaf(leaf, result);
+							if (action == AcceptLeaf) {
+								leaf_slot = parent_id + parent_ref.child_offset + child_shift;
+								result.cell = decodeCell(raw_data[leaf_slot].color);
+								break;
+							}
+							if (action == ReturnHit) {
+								return result;
+							}
+						}
+						else {
+							// Add parent to the stack
+							stack[scale - DEPTH_OFFSET].parent_index = parent_id;
+							stack[scale - DEPTH_OFFSET].t_max = t_max;
+							// Update current voxel
+							parent_id += parent_ref.child_offset + child_shift;
+							child_offset = 0u;
+							--scale;
+							scale_f = half;
+							if (t_half.x > t_min) { child_offset ^= 1u, pos.x += scale_f; }
+							if (t_half.y > t_min) { child_offset ^= 2u, pos.y += scale_f; }
+							if (t_half.z > t_min) { child_offset ^= 4u, pos.z += scale_f; }
+							t_max = tv_max;
+							continue;
+						}
 					}
-					h = tc_max;
-					// Update current voxel
-					parent_id += parent_ref.child_offset + child_shift;
-					child_offset = 0u;
-					--scale;
-					scale_f = half;
-					if (t_half.x > t_min) { child_offset ^= 1u, pos.x += scale_f; }
-					if (t_half.y > t_min) { child_offset ^= 2u, pos.y += scale_f; }
-					if (t_half.z > t_min) { child_offset ^= 4u, pos.z += scale_f; }
-					t_max = tv_max;
-					continue;
-				}
-			} // End of depth exploration
+				} // End of depth exploration
 
-			uint32_t step_mask = 0u;
-			if (t_corner.x <= tc_max) { step_mask ^= 1u, pos.x -= scale_f; }
-			if (t_corner.y <= tc_max) { step_mask ^= 2u, pos.y -= scale_f; }
-			if (t_corner.z <= tc_max) { step_mask ^= 4u, pos.z -= scale_f; }
+				uint32_t step_mask = 0u;
+				if (t_corner.x <= tc_max) { step_mask ^= 1u, pos.x -= scale_f; }
+				if (t_corner.y <= tc_max) { step_mask ^= 2u, pos.y -= scale_f; }
+				if (t_corner.z <= tc_max) { step_mask ^= 4u, pos.z -= scale_f; }
 
-			t_min = tc_max;
-			child_offset ^= step_mask;
-			normal = step_mask;
+				t_min = tc_max;
+				child_offset ^= step_mask;
+				normal = step_mask;
 
-			if (child_offset & step_mask) {
-				uint32_t differing_bits = 0u;
-				const int32_t ipos_x = floatAsInt(pos.x);
-				const int32_t ipos_y = floatAsInt(pos.y);
-				const int32_t ipos_z = floatAsInt(pos.z);
-				if (step_mask & 1u) differing_bits |= (ipos_x ^ floatAsInt(pos.x + scale_f));
-				if (step_mask & 2u) differing_bits |= (ipos_y ^ floatAsInt(pos.y + scale_f));
-				if (step_mask & 4u) differing_bits |= (ipos_z ^ floatAsInt(pos.z + scale_f));
-				scale = (floatAsInt((float)differing_bits) >> SVO_MAX_DEPTH) - 127u;
-				scale_f = intAsFloat((scale - SVO_MAX_DEPTH + 127u) << SVO_MAX_DEPTH);
-				const OctreeStack entry = stack[scale - DEPTH_OFFSET];
-				parent_id = entry.parent_index;
-				t_max = entry.t_max;
-				const uint32_t shx = ipos_x >> scale;
-				const uint32_t shy = ipos_y >> scale;
-				const uint32_t shz = ipos_z >> scale;
-				pos.x = intAsFloat(shx << scale);
-				pos.y = intAsFloat(shy << scale);
-				pos.z = intAsFloat(shz << scale);
-				child_offset = (shx & 1u) | ((shy & 1u) << 1u) | ((shz & 1u) << 2u);
-				h = 0.0f;
+				if (child_offset & step_mask) {
+					uint32_t differing_bits = 0u;
+					const int32_t ipos_x = floatAsInt(pos.x);
+					const int32_t ipos_y = floatAsInt(pos.y);
+					const int32_t ipos_z = floatAsInt(pos.z);
+					if (step_mask & 1u) differing_bits |= (ipos_x ^ floatAsInt(pos.x + scale_f));
+					if (step_mask & 2u) differing_bits |= (ipos_y ^ floatAsInt(pos.y + scale_f));
+					if (step_mask & 4u) differing_bits |= (ipos_z ^ floatAsInt(pos.z + scale_f));
+					scale = (floatAsInt((float)differing_bits) >> SVO_MAX_DEPTH) - 127u;
+					scale_f = intAsFloat((scale - SVO_MAX_DEPTH + 127u) << SVO_MAX_DEPTH);
+					const OctreeStack entry = stack[scale - DEPTH_OFFSET];
+					parent_id = entry.parent_index;
+					t_max = entry.t_max;
+					const uint32_t shx = ipos_x >> scale;
+					const uint32_t shy = ipos_y >> scale;
+					const uint32_t shz = ipos_z >> scale;
+					pos.x = intAsFloat(shx << scale);
+					pos.y = intAsFloat(shy << scale);
+					pos.z = intAsFloat(shz << scale);
+					child_offset = (shx & 1u) | ((shy & 1u) << 1u) | ((shz & 1u) << 2u);
+				}
 			}
-		}
-		
-		if (result.cell) {
-			result.normal = -glm::sign(d) * glm::vec3(float(normal & 1u), float(normal & 2u), float(normal & 4u));
 
-			if ((mirror_mask & 1) == 0) pos.x = 3.0f - scale_f - pos.x;
-			if ((mirror_mask & 2) == 0) pos.y = 3.0f - scale_f - pos.y;
-			if ((mirror_mask & 4) == 0) pos.z = 3.0f - scale_f - pos.z;
-
-			result.distance = t_min;
-			result.position.x = std::min(std::max(position.x + t_min * d.x, pos.x + EPS), pos.x + scale_f - EPS);
-			result.position.y = std::min(std::max(position.y + t_min * d.y, pos.y + EPS), pos.y + scale_f - EPS);
-			result.position.z = std::min(std::max(position.z + t_min * d.z, pos.z + EPS), pos.z + scale_f - EPS);
+			if (!result.cell) {
+				return result;
+			}
+			const glm::vec3 hit_min = getMirroredMin(pos, scale_f, mirror_mask);
+			setHit(result, position, d, hit_min, scale_f, normal, t_min, leaf_slot);
+			if (!on_hit(result, position, d)) {
+				return result;
+			}
 
-			if (result.normal.x) {
-				result.voxel_coord = glm::vec2(frac(result.position.z * SVO_SIZE), frac(result.position.y * SVO_SIZE));
+			// The cube of each level holding the hit is found from its position's bits, go up to the one holding start
+			const uint32_t complexity = result.complexity;
+			result = HitPoint();
+			result.complexity = complexity;
+			ray_size_bias += t_min * ray_size_coef;
+			setupRay(position, d, t_coef, t_offset, mirror_mask);
+			const glm::ivec3 hit_bits(floatAsInt(hit_min.x), floatAsInt(hit_min.y), floatAsInt(hit_min.z));
+			int8_t level = scale + 1;
+			while (!isInCube(position, getCubeMin(hit_bits, level), getCubeSize(level))) {
+				// The reflected ray starts outside of the tree
+				if (level == SVO_MAX_DEPTH) {
+					return result;
+				}
+				++level;
 			}
-			else if (result.normal.y) {
-				result.voxel_coord = glm::vec2(frac(result.position.x * SVO_SIZE), frac(result.position.z * SVO_SIZE));
+
+			// Exits of the ancestors are the reflected ray's ones, the incoming ray's are still in the stack
+			const float t_end = std::min(1.0f, std::min(t_coef.x - t_offset.x, std::min(t_coef.y - t_offset.y, t_coef.z - t_offset.z)));
+			for (int8_t ancestor(level); ancestor < SVO_MAX_DEPTH; ++ancestor) {
+				const glm::vec3 ancestor_pos = getMirroredMin(getCubeMin(hit_bits, ancestor + 1), getCubeSize(ancestor + 1), mirror_mask);
+				stack[ancestor - DEPTH_OFFSET].t_max = std::min(t_end, getExitT(ancestor_pos, t_coef, t_offset));
 			}
-			else if (result.normal.z) {
-				result.voxel_coord = glm::vec2(frac(result.position.x * SVO_SIZE), frac(result.position.y * SVO_SIZE));
+
+			// Resume in the cube of level as if the ray started there
+			if (level > scale + 1) {
+				parent_id = stack[level - 1 - DEPTH_OFFSET].parent_index;
 			}
+			scale = level - 1;
+			scale_f = getCubeSize(scale);
+			pos = getMirroredMin(getCubeMin(hit_bits, level), getCubeSize(level), mirror_mask);
+			t_min = 0.0f;
+			t_max = std::min(t_end, getExitT(pos, t_coef, t_offset));
+			child_offset = 0u;
+			if ((pos.x + scale_f) * t_coef.x - t_offset.x > t_min) { child_offset ^= 1u, pos.x += scale_f; }
+			if ((pos.y + scale_f) * t_coef.y - t_offset.y > t_min) { child_offset ^= 2u, pos.y += scale_f; }
+			if ((pos.z + scale_f) * t_coef.z - t_offset.z > t_min) { child_offset ^= 4u, pos.z += scale_f; }
+			normal = 0u;
+			leaf_slot = 0u;
 		}
+	}
+
+	// Rays are traced toward -x, -y and -z in mirrored coordinates, where t = corner * t_coef - t_offset.
+	// Tiny direction components are clamped.
+	static void setupRay(const glm::vec3& position, glm::vec3& d, glm::vec3& t_coef, glm::vec3& t_offset, uint8_t& mirror_mask)
+	{
+		constexpr float EPS = 1.0f / float(1 << 23);
+		if (std::abs(d.x) < EPS) { d.x = copysign(EPS, d.x); }
+		if (std::abs(d.y) < EPS) { d.y = copysign(EPS, d.y); }
+		if (std::abs(d.z) < EPS) { d.z = copysign(EPS, d.z); }
+		t_coef = -1.0f / glm::abs(d);
+		t_offset = position * t_coef;
+		mirror_mask = 7u;
+		if (d.x > 0.0f) { mirror_mask ^= 1u, t_offset.x = 3.0f * t_coef.x - t_offset.x; }
+		if (d.y > 0.0f) { mirror_mask ^= 2u, t_offset.y = 3.0f * t_coef.y - t_offset.y; }
+		if (d.z > 0.0f) { mirror_mask ^= 4u, t_offset.z = 3.0f * t_coef.z - t_offset.z; }
+	}
+
+	// Min corner of a cube in mirrored coordinates from the render space one, or the other way around
+	static glm::vec3 getMirroredMin(const glm::vec3& min, float size, uint8_t mirror_mask)
+	{
+		return glm::vec3((mirror_mask & 1u) ? min.x : 3.0f - size - min.x, (mirror_mask & 2u) ? min.y : 3.0f - size - min.y, (mirror_mask & 4u) ? min.z : 3.0f - size - min.z);
+	}
+
+	// Cubes of scale s have a size of 2^(s - 23), their corners are found by clearing the low bits of positions in [1, 2)
+	static float getCubeSize(int8_t scale)
+	{
+		return intAsFloat((scale - 23 + 127) << 23);
+	}
+
+	static glm::vec3 getCubeMin(const glm::ivec3& position_bits, int8_t scale)
+	{
+		return glm::vec3(intAsFloat((position_bits.x >> scale) << scale), intAsFloat((position_bits.y >> scale) << scale), intAsFloat((position_bits.z >> scale) << scale));
+	}
+
+	static bool isInCube(const glm::vec3& position, const glm::vec3& min, float size)
+	{
+		return position.x >= min.x && position.y >= min.y && position.z >= min.z && position.x < min.x + size && position.y < min.y + size && position.z < min.z + size;
+	}
 
-		return result;
+	// Where the ray leaves the cube at pos, in mirrored coordinates
+	static float getExitT(const glm::vec3& pos, const glm::vec3& t_coef, const glm::vec3& t_offset)
+	{
+		return std::min(pos.x * t_coef.x - t_offset.x, std::min(pos.y * t_coef.y - t_offset.y, pos.z * t_coef.z - t_offset.z));
+	}
+
+	// Hit on the cube at min entered at t_min through the face of the normal step mask, 0 if the ray started inside
+	void setHit(HitPoint& result, const glm::vec3& position, const glm::vec3& d, const glm::vec3& min, float size, uint8_t normal, float t_min, uint32_t leaf_slot) const
+	{
+		constexpr float SVO_SIZE = 1 << MAX_DEPTH;
+		constexpr float EPS = 1.0f / float(1 << 23);
+		result.normal = -glm::sign(d) * glm::vec3(float(normal & 1u), float(normal & 2u), float(normal & 4u));
+
+		result.distance = t_min;
+		result.position.x = std::min(std::max(position.x + t_min * d.x, min.x + EPS), min.x + size - EPS);
+		result.position.y = std::min(std::max(position.y + t_min * d.y, min.y + EPS), min.y + size - EPS);
+		result.position.z = std::min(std::max(position.z + t_min * d.z, min.z + EPS), min.z + size - EPS);
+
+		if (result.normal.x) {
+			result.voxel_coord = glm::vec2(frac(result.position.z * SVO_SIZE), frac(result.position.y * SVO_SIZE));
+		}
+		else if (result.normal.y) {
+			result.voxel_coord = glm::vec2(frac(result.position.x * SVO_SIZE), frac(result.position.z * SVO_SIZE));
+		}
+		else if (result.normal.z) {
+			result.voxel_coord = glm::vec2(frac(result.position.x * SVO_SIZE), frac(result.position.y * SVO_SIZE));
+		}
+
+		const FaceOcclusion* leaf_occlusion = (leaf_slot && normal && !occlusion.empty()) ? occlusion.find(leaf_slot) : nullptr;
+		if (leaf_occlusion) {
+			const uint8_t axis = (normal & 1u) ? 0u : ((normal & 2u) ? 1u : 2u);
+			result.occlusion = leaf_occlusion->faces[2u * axis + (d[axis] < 0.0f)];
+		}
 	}
 
 	LNode* getAtRayHit(const glm::vec3& position, glm::vec3 d)
@@ -286,5 +475,6 @@ struct LSVO : public Volumetric
 
 	std::vector<LNode> data;
 	const LNode* raw_data;
-	Cell* cell;
+	// Voxel sized leaves only, empty until baked
+	OcclusionTable occlusion;
 };
@@ -1,6 +1,9 @@
 #pragma once
 
 #include "svo.hpp"
+#include "swarm/swarm.hpp"
+#include <atomic>
+#include <bitset>
 
 struct LNode
 {
@@ -11,6 +14,7 @@ struct LNode
 		, color(1u)
 	{}
 
+	// Encoded cell of a leaf, nodes keep their first child's one for hits stopped by the level of detail
 	uint8_t  color;
 	uint8_t  child_mask;
 	uint8_t  leaf_mask;
@@ -18,6 +22,17 @@ struct LNode
 };
 
 
+// Cells are stored in LNode::color as type * 4 + texture
+inline uint8_t encodeCell(const Cell& cell)
+{
+	return uint8_t((uint8_t(cell.type) << 2U) | uint8_t(cell.texture));
+}
+
+
+// Cell hits point to for an LNode::color
+const Cell* decodeCell(uint8_t color);
+
+
 struct vec3bool
 {
 	vec3bool() : data(0U) {}
@@ -39,7 +54,128 @@ struct OctreeStack
 };
 
 
-void compileSVO_rec(const Node* node, std::vector<LNode>& data, const uint32_t node_index, uint32_t& max_offset);
+// Ambient occlusion of the faces of a voxel leaf, 2 bits per face corner from 0 (open) to 3 (fully occluded).
+// Faces are indexed by axis * 2 + 1 if they look toward +axis, corners by u + 2 * v where u and v follow HitPoint::voxel_coord.
+struct FaceOcclusion
+{
+	FaceOcclusion()
+		: faces{0U, 0U, 0U, 0U, 0U, 0U}
+	{}
+
+	uint8_t faces[6];
+};
+
+
+// Dense occupancy of a compiled tree, 1 bit per voxel in render voxel coordinates (LSVO mirrors SVO ones)
+struct OccupancyGrid
+{
+	OccupancyGrid(uint32_t max_depth)
+		: size(1 << max_depth)
+		, bits((uint64_t(size) * size * size + 63U) / 64U, 0U)
+	{}
+
+	bool isOccupied(const glm::ivec3& voxel) const
+	{
+		if (voxel.x < 0 || voxel.y < 0 || voxel.z < 0 || voxel.x >= size || voxel.y >= size || voxel.z >= size) {
+			return false;
+		}
+		const uint64_t index = getIndex(voxel);
+		return (bits[index >> 6U] >> (index & 63U)) & 1U;
+	}
+
+	uint64_t getIndex(const glm::ivec3& voxel) const
+	{
+		return (uint64_t(voxel.z) * size + voxel.y) * size + voxel.x;
+	}
+
+	// Sets the voxels of a cube, min is in render voxel coordinates
+	void fill(const glm::ivec3& min, int32_t cube_size);
+
+	int32_t size;
+	std::vector<uint64_t> bits;
+};
+
+
+// Leaf of the size of a voxel and its slot in the compiled tree
+struct VoxelLeaf
+{
+	uint32_t slot;
+	glm::ivec3 voxel;
+};
+
+
+// Lists the voxel sized leaves and fills the grid with all leaves, origin and size are in SVO voxels
+void collectLeaves_rec(const std::vector<LNode>& data, uint32_t node_index, const glm::ivec3& origin, int32_t size, OccupancyGrid& grid, std::vector<VoxelLeaf>& leaves);
+
+
+// Occlusion of the voxel sized leaves only, found from their slot in the compiled tree.
+// One bit per slot tells if it has an entry, the entry's index is the number of bits set before it.
+struct OcclusionTable
+{
+	// Sized for the leaves, entries are then written by bakeOcclusion
+	void reset(const std::vector<VoxelLeaf>& leaves, uint32_t slot_count);
+
+	bool empty() const
+	{
+		return faces.empty();
+	}
+
+	// nullptr if the slot isn't a voxel sized leaf
+	const FaceOcclusion* find(uint32_t slot) const
+	{
+		const uint64_t word = slot_bits[slot >> 6U];
+		const uint64_t bit = uint64_t(1U) << (slot & 63U);
+		if (!(word & bit)) {
+			return nullptr;
+		}
+		return &faces[getIndex(slot)];
+	}
+
+	uint32_t getIndex(uint32_t slot) const
+	{
+		const uint64_t lower_bits = slot_bits[slot >> 6U] & ((uint64_t(1U) << (slot & 63U)) - 1U);
+		return word_counts[slot >> 6U] + uint32_t(std::bitset<64>(lower_bits).count());
+	}
+
+	std::vector<uint64_t> slot_bits;
+	// Bits set in the words before each word
+	std::vector<uint32_t> word_counts;
+	std::vector<FaceOcclusion> faces;
+};
+
+
+// Corner occlusion of the leaves from first, taking one every step. Larger leaves aren't occluded.
+void bakeOcclusion(const OccupancyGrid& grid, const std::vector<VoxelLeaf>& leaves, OcclusionTable& occlusion, uint32_t first, uint32_t step);
+
+
+// Returns the cell shared by the whole subtree if it has been collapsed into a leaf, nullptr otherwise
+const Cell* compileSVO_rec(const NodePool& nodes, const Node& node, std::vector<LNode>& data, const uint32_t node_index, uint32_t& max_offset);
+
+
+// Subtree compiled on its own, its root is at index 0 of its local buffer.
+// Its root goes in slot sub_index of node parent_index and the rest at base in the final buffer.
+struct CompileTask
+{
+	const Node* node;
+	uint32_t parent_index;
+	uint8_t sub_index;
+	uint32_t base;
+	std::vector<LNode> data;
+	const Cell* cell;
+};
+
+
+// Lists the subtrees at split_depth, in the order compileSVO_rec reaches them
+void collectCompileTasks_rec(const NodePool& nodes, const Node& node, uint32_t split_depth, std::vector<CompileTask>& tasks);
+
+
+// compileSVO_rec for the levels above split_depth once the tasks are compiled, they are taken in order from next_task.
+// Subtrees that didn't collapse only get their room in data, mergeCompileTask fills it.
+const Cell* compileSVOTop_rec(const NodePool& nodes, const Node& node, std::vector<LNode>& data, const uint32_t node_index, uint32_t split_depth, std::vector<CompileTask>& tasks, uint32_t& next_task);
+
+
+// Copies a compiled subtree in data
+void mergeCompileTask(const CompileTask& task, std::vector<LNode>& data);
 
 
 template<uint8_t N>
@@ -49,7 +185,64 @@ std::vector<LNode> compileSVO(const SVO<N>& svo)
 	data.push_back(LNode());
 
 	uint32_t max_offset = 0U;
-	compileSVO_rec(svo.m_root, data, 0, max_offset);
+	if (const Cell* cell = compileSVO_rec(svo.m_nodes, svo.getNode(svo.m_root), data, 0, max_offset)) {
+		// The whole volume is uniform, the root has to stay a node so only its children become leaves
+		data[0].child_mask = 0xFF;
+		data[0].leaf_mask = 0xFF;
+		data[0].child_offset = 1U;
+		data[0].color = encodeCell(*cell);
+		LNode leaf;
+		leaf.color = data[0].color;
+		data.resize(9U, leaf);
+	}
+
+	return data;
+}
+
+
+// Same output as compileSVO but subtrees below split_depth are compiled by the swarm's workers
+template<uint8_t N>
+std::vector<LNode> compileSVO(const SVO<N>& svo, swrm::Swarm& swarm, uint32_t split_depth = 3U)
+{
+	std::vector<CompileTask> tasks;
+	collectCompileTasks_rec(svo.m_nodes, svo.getNode(svo.m_root), split_depth, tasks);
+
+	// Compile subtrees in their own buffers, tasks are picked dynamically since their sizes vary a lot
+	std::atomic<uint32_t> next_task(0U);
+	const uint32_t task_count = uint32_t(tasks.size());
+	swarm.execute([&](uint32_t thread_id, uint32_t max_thread) {
+		for (uint32_t i(next_task++); i < task_count; i = next_task++) {
+			CompileTask& task = tasks[i];
+			task.data.push_back(LNode());
+			uint32_t max_offset = 0U;
+			task.cell = compileSVO_rec(svo.m_nodes, *task.node, task.data, 0, max_offset);
+		}
+	}).waitExecutionDone();
+
+	// The top levels are laid out and collapsed like compileSVO does once the subtrees' cells and sizes are known
+	std::vector<LNode> data;
+	data.push_back(LNode());
+	uint32_t top_task = 0U;
+	if (const Cell* cell = compileSVOTop_rec(svo.m_nodes, svo.getNode(svo.m_root), data, 0, split_depth, tasks, top_task)) {
+		data[0].child_mask = 0xFF;
+		data[0].leaf_mask = 0xFF;
+		data[0].child_offset = 1U;
+		data[0].color = encodeCell(*cell);
+		LNode leaf;
+		leaf.color = data[0].color;
+		data.resize(9U, leaf);
+	}
+
+	next_task = 0U;
+	swarm.execute([&](uint32_t thread_id, uint32_t max_thread) {
+		for (uint32_t i(next_task++); i < task_count; i = next_task++) {
+			if (!tasks[i].cell) {
+				mergeCompileTask(tasks[i], data);
+			}
+			// Release memory as soon as possible
+			std::vector<LNode>().swap(tasks[i].data);
+		}
+	}).waitExecutionDone();
 
 	return data;
-}
\ No newline at end of file
+}
@@ -1,17 +1,234 @@
 #pragma once
 
-#include <array>
+#include <vector>
+#include <unordered_map>
 
 #include "volumetric.hpp"
+#include "utils.hpp"
 
 
+// Cell of one level of the mipmap, a cell of level L covers 2^L voxels per axis
 struct MipmapCell
 {
-	MipmapCell();
+	MipmapCell(const glm::ivec3& voxel, uint8_t level_)
+		: coord(voxel.x >> level_, voxel.y >> level_, voxel.z >> level_)
+		, level(level_)
+	{}
+
+	glm::ivec3 getMin() const
+	{
+		return glm::ivec3(coord.x << level, coord.y << level, coord.z << level);
+	}
+
+	glm::ivec3 getMax() const
+	{
+		return glm::ivec3((coord.x + 1) << level, (coord.y + 1) << level, (coord.z + 1) << level);
+	}
+
+	glm::ivec3 coord;
+	uint8_t level;
 };
 
 
+// Dense occupancy grid with 1 bit per voxel, each of the MipmapDepth coarser levels ORs 2x2x2 cells
+// of the previous one so rays can jump over large empty regions. Works in voxel space like Grid3D,
+// the grid spans [0, X) x [0, Y) x [0, Z).
 template<int32_t X, int32_t Y, int32_t Z, uint32_t MipmapDepth>
-struct MipmapGrid3D
+struct MipmapGrid3D : public Volumetric
 {
+	static constexpr uint32_t LEVEL_COUNT = MipmapDepth + 1u;
+
+	MipmapGrid3D()
+	{
+		default_cell.type = Cell::Solid;
+		default_cell.texture = Cell::Grass;
+		for (uint32_t level(0u); level < LEVEL_COUNT; ++level) {
+			m_sizes[level] = glm::ivec3(((X - 1) >> level) + 1, ((Y - 1) >> level) + 1, ((Z - 1) >> level) + 1);
+			const uint64_t cell_count = uint64_t(m_sizes[level].x) * m_sizes[level].y * m_sizes[level].z;
+			m_levels[level].assign((cell_count + 63u) / 64u, 0u);
+		}
+	}
+
+	void setCell(Cell::Type type, Cell::Texture texture, uint32_t x, uint32_t y, uint32_t z) override
+	{
+		const glm::ivec3 voxel(x, y, z);
+		const uint64_t index = getIndex(voxel, 0u);
+		if (type == Cell::Empty) {
+			m_materials.erase(index);
+			setBit(0u, index, false);
+			// Coarse cells stay occupied as long as one of their children is
+			for (uint8_t level(1u); level < LEVEL_COUNT; ++level) {
+				const MipmapCell cell(voxel, level);
+				if (isChildOccupied(cell)) {
+					break;
+				}
+				setBit(level, getIndex(voxel, level), false);
+			}
+			return;
+		}
+
+		if (type != default_cell.type || texture != default_cell.texture) {
+			Cell& cell = m_materials[index];
+			cell.type = type;
+			cell.texture = texture;
+		}
+		else {
+			m_materials.erase(index);
+		}
+		for (uint8_t level(0u); level < LEVEL_COUNT; ++level) {
+			setBit(level, getIndex(voxel, level), true);
+		}
+	}
+
+	bool isOccupied(const glm::ivec3& voxel, uint8_t level) const
+	{
+		const uint64_t index = getIndex(voxel, level);
+		return (m_levels[level][index >> 6u] >> (index & 63u)) & 1u;
+	}
+
+	HitPoint castRay(const glm::vec3& position, glm::vec3 d, const float ray_size_coef = 0.0f, const float ray_size_bias = 0.0f) const override
+	{
+		HitPoint result;
+		constexpr float EPS = 1.0f / float(1 << 23);
+		if (std::abs(d.x) < EPS) { d.x = copysign(EPS, d.x); }
+		if (std::abs(d.y) < EPS) { d.y = copysign(EPS, d.y); }
+		if (std::abs(d.z) < EPS) { d.z = copysign(EPS, d.z); }
+		const glm::vec3 inv_d = 1.0f / d;
+		const glm::vec3 t_0 = -position * inv_d;
+		const glm::vec3 grid_size = glm::vec3(X, Y, Z);
+		const glm::vec3 t_1 = (grid_size - position) * inv_d;
+		const glm::vec3 t_near = glm::min(t_0, t_1);
+		const glm::vec3 t_far = glm::max(t_0, t_1);
+		float t = std::max(0.0f, std::max(t_near.x, std::max(t_near.y, t_near.z)));
+		const float t_exit = std::min(t_far.x, std::min(t_far.y, t_far.z));
+		if (t > t_exit) {
+			return result;
+		}
+
+		const glm::ivec3 step(d.x > 0.0f ? 1 : -1, d.y > 0.0f ? 1 : -1, d.z > 0.0f ? 1 : -1);
+		const glm::ivec3 grid_max(X - 1, Y - 1, Z - 1);
+		// Axis through which the current cell has been entered, -1 if the ray starts inside
+		int8_t axis = -1;
+		if (t > 0.0f) {
+			axis = (t_near.x >= t_near.y && t_near.x >= t_near.z) ? 0 : (t_near.y >= t_near.z ? 1 : 2);
+		}
+
+		// The current voxel is tracked with integers so jumps don't accumulate float errors
+		glm::ivec3 voxel = clampVoxel(glm::ivec3(glm::floor(position + t * d)), glm::ivec3(0), grid_max);
+		uint8_t level = MipmapDepth;
+		while (true) {
+			++result.complexity;
+			if (isOccupied(voxel, level)) {
+				if (level) {
+					--level;
+					continue;
+				}
+				setHit(result, position, d, voxel, t, axis, step);
+				return result;
+			}
+
+			// Exit the empty cell
+			const MipmapCell cell(voxel, level);
+			const glm::ivec3 cell_min = cell.getMin();
+			const glm::ivec3 cell_max = cell.getMax();
+			const glm::vec3 t_cell = (glm::vec3(
+				float(step.x > 0 ? cell_max.x : cell_min.x),
+				float(step.y > 0 ? cell_max.y : cell_min.y),
+				float(step.z > 0 ? cell_max.z : cell_min.z)) - position) * inv_d;
+			axis = (t_cell.x <= t_cell.y && t_cell.x <= t_cell.z) ? 0 : (t_cell.y <= t_cell.z ? 1 : 2);
+			t = t_cell[axis];
+			if (t > t_exit) {
+				return result;
+			}
+
+			// The ray leaves the cell through one face, on the other axes it is still within the cell's bounds
+			const glm::ivec3 cell_last = cell_max - 1;
+			voxel = clampVoxel(glm::ivec3(glm::floor(position + t * d)), cell_min, cell_last);
+			voxel[axis] = step[axis] > 0 ? cell_max[axis] : cell_min[axis] - 1;
+			if (voxel[axis] < 0 || voxel[axis] > grid_max[axis]) {
+				return result;
+			}
+
+			// The next cell may be in an empty parent
+			if (level < MipmapDepth) {
+				++level;
+			}
+		}
+	}
+
+	// Cell used for voxels without a specific material
+	Cell default_cell;
+
+private:
+	glm::ivec3 m_sizes[LEVEL_COUNT];
+	std::vector<uint64_t> m_levels[LEVEL_COUNT];
+	std::unordered_map<uint64_t, Cell> m_materials;
+
+	uint64_t getIndex(const glm::ivec3& voxel, uint8_t level) const
+	{
+		const glm::ivec3& size = m_sizes[level];
+		return (uint64_t(voxel.x >> level) * size.y + (voxel.y >> level)) * size.z + (voxel.z >> level);
+	}
+
+	void setBit(uint8_t level, uint64_t index, bool value)
+	{
+		const uint64_t mask = uint64_t(1u) << (index & 63u);
+		if (value) {
+			m_levels[level][index >> 6u] |= mask;
+		}
+		else {
+			m_levels[level][index >> 6u] &= ~mask;
+		}
+	}
+
+	bool isChildOccupied(const MipmapCell& cell) const
+	{
+		const uint8_t child_level = cell.level - 1u;
+		const glm::ivec3& child_size = m_sizes[child_level];
+		for (uint8_t i(0u); i < 8u; ++i) {
+			const glm::ivec3 child = cell.coord * 2 + glm::ivec3(i & 1u, (i >> 1u) & 1u, i >> 2u);
+			if (child.x < child_size.x && child.y < child_size.y && child.z < child_size.z) {
+				if (isOccupied(glm::ivec3(child.x << child_level, child.y << child_level, child.z << child_level), child_level)) {
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	static glm::ivec3 clampVoxel(const glm::ivec3& voxel, const glm::ivec3& min, const glm::ivec3& max)
+	{
+		return glm::ivec3(
+			std::min(std::max(voxel.x, min.x), max.x),
+			std::min(std::max(voxel.y, min.y), max.y),
+			std::min(std::max(voxel.z, min.z), max.z));
+	}
+
+	const Cell* getCell(const glm::ivec3& voxel) const
+	{
+		const auto it = m_materials.find(getIndex(voxel, 0u));
+		return it == m_materials.end() ? &default_cell : &(it->second);
+	}
+
+	// Same normal and texture coordinates conventions as Grid3D
+	void setHit(HitPoint& hit, const glm::vec3& position, const glm::vec3& d, const glm::ivec3& voxel, float t, int8_t axis, const glm::ivec3& step) const
+	{
+		const glm::vec3 hit_position = position + t * d;
+		hit.cell = getCell(voxel);
+		hit.position = hit_position;
+		hit.distance = t;
+		hit.normal = glm::vec3(0.0f);
+		if (axis == 0) {
+			hit.normal.x = float(-step.x);
+			hit.voxel_coord = glm::vec2(1.0f - frac(hit_position.z), frac(hit_position.y));
+		}
+		else if (axis == 1) {
+			hit.normal.y = float(-step.y);
+			hit.voxel_coord = glm::vec2(frac(hit_position.x), frac(hit_position.z));
+		}
+		else if (axis == 2) {
+			hit.normal.z = float(-step.z);
+			hit.voxel_coord = glm::vec2(frac(hit_position.x), frac(hit_position.y));
+		}
+	}
 };
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+#include <SFML/Graphics.hpp>
+#include "swarm/swarm.hpp"
+
+
+// Brings rendered images to the window through one persistent texture.
+// The temporal blend with the previous frames is done on the CPU in a float buffer, only the rows whose 8 bits
+// value changed are uploaded. submit and draw are separate so a frame can be drawn while the next one is rendered.
+struct Presenter
+{
+	Presenter(const sf::Vector2i& render_size, swrm::Swarm& swarm)
+		: size(render_size)
+		, m_swarm(swarm)
+		, m_history(render_size.x * render_size.y * 3u, 0.0f)
+		, m_pixels(render_size.x * render_size.y * 4u, 255u)
+		, m_dirty_rows(render_size.y, 1u)
+	{
+		m_texture.create(size.x, size.y);
+		m_texture.setSmooth(false);
+		m_sprite.setTexture(m_texture, true);
+	}
+
+	// Blends the image with the previous ones, old_value_conservation is the weight kept from the history
+	void submit(const sf::Image& image, float old_value_conservation)
+	{
+		const uint8_t* source = image.getPixelsPtr();
+		m_swarm.execute([&](uint32_t thread_id, uint32_t max_thread) {
+			for (int32_t y(thread_id); y < size.y; y += max_thread) {
+				uint8_t dirty = m_dirty_rows[y];
+				for (int32_t x(0); x < size.x; ++x) {
+					const uint32_t index = y * size.x + x;
+					for (uint32_t c(0u); c < 3u; ++c) {
+						float& value = m_history[3u * index + c];
+						value += (1.0f - old_value_conservation) * (float(source[4u * index + c]) - value);
+						const uint8_t pixel = uint8_t(value + 0.5f);
+						dirty |= uint8_t(pixel != m_pixels[4u * index + c]);
+						m_pixels[4u * index + c] = pixel;
+					}
+				}
+				m_dirty_rows[y] = dirty;
+			}
+		}).waitExecutionDone();
+	}
+
+	// Uploads the rows changed since the last call, has to be called from the thread owning the target's context
+	void draw(sf::RenderTarget& target, float scale)
+	{
+		int32_t y(0);
+		while (y < size.y) {
+			if (!m_dirty_rows[y]) {
+				++y;
+				continue;
+			}
+			// Consecutive dirty rows are uploaded at once
+			const int32_t start = y;
+			while (y < size.y && m_dirty_rows[y]) {
+				m_dirty_rows[y++] = 0u;
+			}
+			m_texture.update(&m_pixels[4u * start * size.x], size.x, y - start, 0u, start);
+		}
+
+		m_sprite.setScale(scale, scale);
+		target.draw(m_sprite);
+	}
+
+	const sf::Vector2i size;
+
+private:
+	swrm::Swarm& m_swarm;
+	// Blended colors, 3 floats per pixel in [0, 255]
+	std::vector<float> m_history;
+	// m_history rounded to RGBA, the layout sf::Texture::update expects
+	std::vector<uint8_t> m_pixels;
+	std::vector<uint8_t> m_dirty_rows;
+	sf::Texture m_texture;
+	sf::Sprite m_sprite;
+};
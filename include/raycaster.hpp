@@ -1,9 +1,13 @@
 #pragma once
 
 
+#include <atomic>
+#include <limits>
 #include <SFML/Graphics.hpp>
 #include "lsvo.hpp"
 #include "utils.hpp"
+#include "god_rays.hpp"
+#include "texture_atlas.hpp"
 
 
 struct RayContext
@@ -43,15 +47,25 @@ constexpr uint8_t SVO_DEPTH = 9u;
 struct RayCaster
 {
 	const float eps = 0.001f;
-	const float sun_intensity = 1000000.0f;
+	// Sun radiance relative to the direct light, which is 1 on a surface facing the sun
+	const float sun_radiance = 1.0f;
+	// Offsets along the normal of the rays leaving a surface
+	const float shadow_offset = 0.001f / float(1 << SVO_DEPTH);
+	const float gi_offset = 0.015625f / float(1 << SVO_DEPTH);
 
-	RayCaster(const LSVO<SVO_DEPTH>& svo_, const sf::Vector2i& render_size_)
+	RayCaster(const Volumetric& svo_, const sf::Vector2i& render_size_)
 		: svo(svo_)
+		, dynamic_layer(nullptr)
 		, render_size(render_size_)
+		, depths(render_size_.x * render_size_.y, 0.0f)
+		, god_rays(render_size_)
 	{
 		render_image.create(render_size.x, render_size.y);
-		image_side.loadFromFile("res/grass_side_16x16.bmp");
-		image_top.loadFromFile("res/grass_top_16x16.bmp");
+		textures.setMaterial(Cell::Grass, textures.loadTile("res/grass_side_16x16.bmp"), textures.loadTile("res/grass_top_16x16.bmp"));
+		const uint32_t red_tile = textures.addTile(sf::Color::Red);
+		textures.setMaterial(Cell::Red, red_tile, red_tile);
+		const uint32_t white_tile = textures.addTile(sf::Color::White);
+		textures.setMaterial(Cell::White, white_tile, white_tile);
 
 		colors.resize(render_size_.x);
 		for (auto& v : colors) {
@@ -62,17 +76,29 @@ struct RayCaster
 	void setLightPosition(const glm::vec3& position)
 	{
 		light_position = position;
+		god_rays.light_cache.setLight(position);
 	}
 
 	void renderRay(const sf::Vector2i pixel, const glm::vec3& start, const glm::vec3& direction, float time)
 	{
-		const uint32_t x = pixel.x;
-		const uint32_t y = pixel.y;
-
 		RayContext context;
 		context.distance = 0.0f;
 
-		ColorResult result = castRay(start, direction, 1.5f * time, context);
+		setPixel(pixel, castRay(start, direction, 1.5f * time, context));
+	}
+
+	// Stores the depth, adds god rays and blends the color with the previous ones
+	void setPixel(const sf::Vector2i pixel, ColorResult result)
+	{
+		const uint32_t x = pixel.x;
+		const uint32_t y = pixel.y;
+
+		depths[y * render_size.x + x] = result.distance;
+		if (use_god_rays) {
+			sf::Color scattered_light = god_rays_color;
+			mult(scattered_light, god_rays.getScattering(pixel, result.distance));
+			add(result.color, scattered_light);
+		}
 
 		sf::Color old_color = render_image.getPixel(pixel.x, pixel.y);
 
@@ -91,6 +117,15 @@ struct RayCaster
 		}
 	}
 
+	// Marches the ray of one low resolution texel, uses the depths of the previous frame
+	void renderGodRays(const sf::Vector2i& texel, const glm::vec3& start, const glm::vec3& direction)
+	{
+		const sf::Vector2i pixel = god_rays.getSamplePixel(texel);
+		const int32_t x = std::min(pixel.x, render_size.x - 1);
+		const int32_t y = std::min(pixel.y, render_size.y - 1);
+		god_rays.march(svo, texel, start, direction, depths[y * render_size.x + x]);
+	}
+
 	void samples_to_image()
 	{
 		for (int32_t x(0); x < render_size.x; ++x) {
@@ -115,6 +150,130 @@ struct RayCaster
 		}
 	}
 
+	// Nearest hit between the static world and the dynamic objects
+	HitPoint intersect(const glm::vec3& start, const glm::vec3& direction, float ray_size_coef = 0.0f, float ray_size_bias = 0.0f) const
+	{
+		HitPoint result = svo.castRay(start, direction, ray_size_coef, ray_size_bias);
+		if (dynamic_layer) {
+			const HitPoint dynamic_hit = dynamic_layer->castRay(start, direction, ray_size_coef, ray_size_bias);
+			if (dynamic_hit.cell && (!result.cell || dynamic_hit.distance < result.distance)) {
+				const uint32_t complexity = result.complexity;
+				result = dynamic_hit;
+				result.complexity += complexity;
+			}
+			else {
+				result.complexity += dynamic_hit.complexity;
+			}
+		}
+		return result;
+	}
+
+	// Reflections of a ray on the mirrors it hits, each bounce consumes the reflection budget (see reflects).
+	// Mirrors of the world hidden by a dynamic object stop the world's cast, the object's hit is then kept.
+	struct MirrorPath : public MirrorHandler
+	{
+		MirrorPath(RayCaster& raycaster_, const glm::vec3& start_, const glm::vec3& direction_, uint32_t bounds_)
+			: raycaster(raycaster_)
+			, start(start_)
+			, direction(direction_)
+			, throughput(1.0f)
+			, path_length(0.0f)
+			, bounds(bounds_)
+			, reflection_count(0u)
+			, first_distance(0.0f)
+			, hidden(false)
+			, complexity(0u)
+		{}
+
+		bool onMirrorHit(const HitPoint& hit, glm::vec3& start_, glm::vec3& direction_) override
+		{
+			if (raycaster.dynamic_layer) {
+				dynamic_hit = raycaster.dynamic_layer->castRay(start_, direction_);
+				complexity += dynamic_hit.complexity;
+				if (dynamic_hit.cell && dynamic_hit.distance < hit.distance) {
+					hidden = true;
+					return false;
+				}
+			}
+			if (!raycaster.reflects(hit, throughput, bounds)) {
+				return false;
+			}
+			reflect(hit);
+			start_ = start;
+			direction_ = direction;
+			return true;
+		}
+
+		void reflect(const HitPoint& hit)
+		{
+			if (!reflection_count) {
+				first_distance = hit.distance;
+			}
+			++reflection_count;
+			++bounds;
+			throughput *= raycaster.mirror_reflectance;
+			path_length += hit.distance;
+			start = hit.position + glm::sign(hit.normal) * raycaster.shadow_offset;
+			direction = RayCaster::reflect(direction, hit.normal);
+		}
+
+		// Distance of the first hit, 0 for the sky
+		float getDepth(const HitPoint& last_hit) const
+		{
+			return reflection_count ? first_distance : (last_hit.cell ? last_hit.distance : 0.0f);
+		}
+
+		RayCaster& raycaster;
+		// Last reflected ray, the primary one until the first bounce
+		glm::vec3 start;
+		glm::vec3 direction;
+		float throughput;
+		// Distance covered before the last reflection
+		float path_length;
+		uint32_t bounds;
+		uint32_t reflection_count;
+		float first_distance;
+		// Set when a dynamic object hid a mirror of the world, dynamic_hit is then the ray's hit
+		bool hidden;
+		HitPoint dynamic_hit;
+		uint32_t complexity;
+	};
+
+	// intersect following the mirrors, the world resumes its own traversal on its mirrors while the dynamic objects'
+	// mirrors make the world's cast start again from the reflection
+	HitPoint intersect(MirrorPath& path)
+	{
+		while (true) {
+			path.hidden = false;
+			HitPoint result = svo.castMirroredRay(path.start, path.direction, 0.0f, 0.0f, path);
+			bool dynamic = false;
+			if (path.hidden) {
+				result.complexity += path.dynamic_hit.complexity;
+				const uint32_t complexity = result.complexity;
+				result = path.dynamic_hit;
+				result.complexity = complexity;
+				dynamic = true;
+			}
+			else if (dynamic_layer) {
+				const HitPoint dynamic_hit = dynamic_layer->castRay(path.start, path.direction);
+				result.complexity += dynamic_hit.complexity;
+				if (dynamic_hit.cell && (!result.cell || dynamic_hit.distance < result.distance)) {
+					const uint32_t complexity = result.complexity;
+					result = dynamic_hit;
+					result.complexity = complexity;
+					dynamic = true;
+				}
+			}
+			result.complexity += path.complexity;
+			path.complexity = 0u;
+			// The world's mirrors already went through the path
+			if (!dynamic || !result.cell || !reflects(result, path.throughput, path.bounds)) {
+				return result;
+			}
+			path.reflect(result);
+		}
+	}
+
 	ColorResult castRay(const glm::vec3& start, const glm::vec3& direction, float time, RayContext& context)
 	{
 		// Const values
@@ -128,21 +287,22 @@ struct RayCaster
 			return result;
 		}
 
-		const HitPoint intersection = svo.castRay(start, direction, 0.0f, 0.0f);
+		// Each reflection attenuates the final color
+		MirrorPath path(*this, start, direction, context.bounds);
+		HitPoint intersection = intersect(path);
 		context.complexity += intersection.complexity;
-		context.distance = intersection.distance;
+		context.bounds = path.bounds;
+		context.distance = path.getDepth(intersection);
+		result.distance = context.distance;
+		const glm::vec3& ray_direction = path.direction;
+		const float throughput = path.throughput;
+		const float path_length = path.path_length;
 
 		if (intersection.cell) {
 			const glm::vec3& normal = intersection.normal;
-			result.distance = intersection.distance;
 			const Cell& cell = *(intersection.cell);
-			const glm::vec3 hit_position = intersection.position + normal * SCALE * 0.001f;
-
-			sf::Color albedo = sf::Color::White;
-			if (cell.type == Cell::Solid) {
-				albedo = getTextureColorFromHitPoint(intersection);
-				result.color = albedo;
-			}
+			const glm::vec3 hit_position = intersection.position + normal * shadow_offset;
+			const glm::vec3 albedo = getAlbedo(intersection, ray_direction, path_length);
 
 			const uint32_t shadow_sample = use_samples ? 4U : 1U;
 			float light_intensity = 0.0f;
@@ -150,7 +310,7 @@ struct RayCaster
 				for (uint32_t i(shadow_sample); i--;) {
 					const glm::vec3 light_point = light_position;// +glm::vec3(getRand(-25.0f, 25.0f), getRand(-25.0f, 25.0f), 0.0f);
 					const glm::vec3 point_to_light = glm::normalize(light_point - hit_position);
-					const HitPoint light_intersection = svo.castRay(hit_position, point_to_light);
+					const HitPoint light_intersection = intersect(hit_position, point_to_light);
 
 					if (!light_intersection.cell) {
 						light_intensity = std::max(0.0f, glm::dot(point_to_light, normal));
@@ -158,85 +318,150 @@ struct RayCaster
 				}
 			}
 
-			const float gi_intensity = use_gi ? getGlobalIllumination(intersection) : 0.0f;
+			const float gi_intensity = use_gi ? getGlobalIllumination(intersection, context) : 0.0f;
+			const float ambient_occlusion = use_ao ? getAmbientOcclusion(intersection) : 1.0f;
 
-			mult(result.color, std::min(1.0f, std::max(0.0f, light_intensity + gi_intensity)));
+			result.color = toColor(albedo * (throughput * ambient_occlusion * std::min(1.0f, std::max(0.0f, light_intensity + gi_intensity))));
 		}
 
 		return result;
 	}
 
-	float getGlobalIllumination(const HitPoint& point)
+	// Maximum number of reflections until the next call, mirrors are shaded like solid cells once it is reached
+	void setReflectionBudget(int32_t budget)
 	{
-		constexpr float SCALE = 1.0f / 512.0f;
-		constexpr float n_normalizer = SCALE * 0.0078125f * 2.0f;
-		constexpr uint32_t ray_count = 1U;
-		const glm::vec3 gi_start = point.position + point.normal * n_normalizer;
-		float acc = 0.0f;
-		const glm::vec3& normal = point.normal;
-		constexpr float range = 1000.0f;
-		for (uint32_t i(ray_count); i--;) {
-			glm::vec3 noise_normal;
-			const float coord_1 = getRand(-range, range);
-			const float coord_2 = getRand(-range, range);
-			if (normal.x) {
-				noise_normal = glm::vec3(0.0f, coord_1, coord_2);
-			}
-			else if (normal.y) {
-				noise_normal = glm::vec3(coord_1, 0.0f, coord_2);
-			}
-			else if (normal.z) {
-				noise_normal = glm::vec3(coord_1, coord_2, 0.0f);
-			}
+		m_reflection_budget.store(budget, std::memory_order_relaxed);
+	}
 
-			const glm::vec3 gi_ray = glm::normalize((normal + noise_normal) * n_normalizer);
-			const float dot_gi = glm::dot(gi_ray, point.normal);
-			const HitPoint gi_point = svo.castRay(gi_start, gi_ray, 0.5f, 0.0f);
-			if (gi_point.cell) {
-				const glm::vec3 gi_light_start = gi_point.position + gi_point.normal * n_normalizer;
-				const glm::vec3 to_light = glm::normalize(light_position - gi_light_start);
-				const HitPoint gi_light_point = svo.castRay(gi_light_start, to_light, 0.5f, 0.0f);
-				if (!gi_light_point.cell) {
-					const float dot = glm::dot(gi_point.normal, to_light);
-					acc += sun_intensity * std::min(0.5f, std::max(0.0f, dot) * dot_gi);
-				}
-			}
-		}
+	// Consumes the reflection budget if the ray bounces on the hit point
+	bool reflects(const HitPoint& point, float throughput, uint32_t bounds)
+	{
+		return point.cell->type == Cell::Mirror && point.normal != glm::vec3(0.0f) && bounds < max_bounds
+			&& throughput * mirror_reflectance >= min_throughput && m_reflection_budget.fetch_sub(1, std::memory_order_relaxed) > 0;
+	}
 
-		return std::max(0.0f, acc / float(ray_count));
+	// Normals' components aren't always unit ones, only their signs are used
+	static glm::vec3 reflect(const glm::vec3& direction, const glm::vec3& normal)
+	{
+		const glm::vec3 n = glm::sign(normal);
+		return direction - 2.0f * glm::dot(direction, n) * n;
 	}
 
-	const sf::Image& getTextureFromNormal(const glm::vec3& normal)
+	// Texture color of the hit cell, the mip level follows the ray's footprint on the face.
+	// path_length is the distance covered before the ray was reflected.
+	glm::vec3 getAlbedo(const HitPoint& point, const glm::vec3& direction, float path_length = 0.0f) const
 	{
-		if (normal.y) {
-			return image_top;
-		}
+		constexpr float SVO_SIZE = 1 << SVO_DEPTH;
+		// Width of the ray on the face, it stretches as the face gets parallel to the ray
+		const float footprint = ray_size_coef * (path_length + point.distance) / std::max(0.2f, std::abs(glm::dot(direction, point.normal)));
+		const uint32_t level = TextureAtlas::getLevel(footprint * SVO_SIZE * float(TextureAtlas::TILE_SIZE));
+		return textures.sample(point.cell->texture, TextureAtlas::getFace(point.normal), point.voxel_coord, level);
+	}
+
+	// Random direction around the normal, cosine distributed. Normals of some volumes aren't unit vectors.
+	glm::vec3 getGIDirection(const glm::vec3& normal) const
+	{
+		constexpr float two_pi = 6.283185307f;
+		const glm::vec3 n = glm::normalize(normal);
+		const glm::vec3 tangent = glm::normalize(glm::cross(std::abs(n.x) > 0.5f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f), n));
+		const glm::vec3 bitangent = glm::cross(n, tangent);
+		const float radius_sq = getRand(0.0f, 1.0f);
+		const float radius = std::sqrt(radius_sq);
+		const float angle = getRand(0.0f, two_pi);
+		return tangent * (radius * std::cos(angle)) + bitangent * (radius * std::sin(angle)) + n * std::sqrt(1.0f - radius_sq);
+	}
+
+	// Light reflected along a GI ray by the point it hit when the light is visible from there, relative to the direct light.
+	// GI rays are cosine distributed so the cosine at their origin cancels with their density, the weight can't exceed 1.
+	float getGILightWeight(const HitPoint& gi_point, const glm::vec3& to_light) const
+	{
+		const float dot = glm::dot(glm::normalize(gi_point.normal), to_light);
+		return sun_radiance * getReflectance(gi_point) * std::max(0.0f, dot);
+	}
 
-		return image_side;
+	// Number of GI bounces left to a ray, the whole ray can't have more than max_bounds bounces
+	int32_t getGIBounceCount(const RayContext& context) const
+	{
+		return std::max(0, std::min(context.gi_bounce, int32_t(max_bounds) - int32_t(context.bounds)));
 	}
 
-	const sf::Color getTextureColorFromHitPoint(const HitPoint& point)
+	// Average color of the hit face's texture, as a single intensity
+	float getReflectance(const HitPoint& point) const
 	{
-		if (point.cell->texture == Cell::Grass) {
-			return getColorFromVoxelCoord(getTextureFromNormal(point.normal), point.voxel_coord);
+		if (point.cell->type != Cell::Solid) {
+			return 0.0f;
 		}
-		else if (point.cell->texture == Cell::Red) {
-			return sf::Color::Red;
+		const glm::vec3 color = textures.sample(point.cell->texture, TextureAtlas::getFace(point.normal), glm::vec2(0.0f), TextureAtlas::LEVEL_COUNT - 1u);
+		return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+	}
+
+	// Attenuates the throughput of a path that bounced on point. After the first bounce, paths are randomly
+	// terminated with a probability following their throughput, survivors are scaled to keep the estimate unbiased.
+	bool continuePath(float& throughput, const HitPoint& point, int32_t bounce) const
+	{
+		// Rays starting inside a voxel hit it without normal, there is no surface to bounce on
+		if (point.normal == glm::vec3(0.0f)) {
+			return false;
 		}
-		else if (point.cell->texture == Cell::White) {
-			return sf::Color::White;
+		throughput *= getReflectance(point);
+		if (bounce) {
+			const float survival = std::min(0.95f, throughput);
+			if (getRand(0.0f, 1.0f) >= survival) {
+				return false;
+			}
+			throughput /= survival;
 		}
-		else {
-			return sf::Color::Magenta;
+		return throughput > 0.0f;
+	}
+
+	// Iterative path from point, the light is sampled with a shadow ray at each vertex (next event estimation).
+	// Paths stop after getGIBounceCount bounces, on a miss or by russian roulette.
+	float getGlobalIllumination(const HitPoint& point, const RayContext& context) const
+	{
+		const int32_t bounce_count = getGIBounceCount(context);
+		glm::vec3 position = point.position;
+		glm::vec3 normal = point.normal;
+		float throughput = 1.0f;
+		float acc = 0.0f;
+		// Rays starting inside a voxel hit it without normal, like in continuePath
+		if (normal == glm::vec3(0.0f)) {
+			return 0.0f;
+		}
+		for (int32_t bounce(0); bounce < bounce_count; ++bounce) {
+			const glm::vec3 gi_ray = getGIDirection(normal);
+			const HitPoint gi_point = intersect(position + normal * gi_offset, gi_ray, 0.5f, 0.0f);
+			if (!gi_point.cell) {
+				break;
+			}
+
+			const glm::vec3 gi_light_start = gi_point.position + gi_point.normal * gi_offset;
+			const glm::vec3 to_light = glm::normalize(light_position - gi_light_start);
+			const HitPoint gi_light_point = intersect(gi_light_start, to_light, 0.5f, 0.0f);
+			if (!gi_light_point.cell) {
+				acc += throughput * getGILightWeight(gi_point, to_light);
+			}
+
+			if (!continuePath(throughput, gi_point, bounce)) {
+				break;
+			}
+			position = gi_point.position;
+			normal = gi_point.normal;
 		}
+
+		return std::max(0.0f, acc);
 	}
 
-	const sf::Color getColorFromVoxelCoord(const sf::Image& image, glm::vec2 coords)
+	// Bilinear interpolation of the occlusion baked at the corners of the hit face, costs no ray
+	float getAmbientOcclusion(const HitPoint& point) const
 	{
-		const sf::Vector2u tex_size = image.getSize();
-		clamp(coords.x, 0.0f, 1.0f);
-		clamp(coords.y, 0.0f, 1.0f);
-		return image.getPixel(uint32_t(tex_size.x * coords.x), uint32_t(tex_size.y * coords.y));
+		constexpr float max_darkening = 0.6f;
+		const uint8_t occlusion = point.occlusion;
+		const float u = point.voxel_coord.x;
+		const float v = point.voxel_coord.y;
+		const float low_v = float(occlusion & 3U) * (1.0f - u) + float((occlusion >> 2U) & 3U) * u;
+		const float high_v = float((occlusion >> 4U) & 3U) * (1.0f - u) + float(occlusion >> 6U) * u;
+		const float level = low_v * (1.0f - v) + high_v * v;
+		return 1.0f - max_darkening * level / 3.0f;
 	}
 
 	const sf::Color getColorFromNormal(const glm::vec3& normal)
@@ -259,14 +484,22 @@ struct RayCaster
 	std::vector<std::vector<Sample>> colors;
 
 	sf::Image render_image;
-	sf::Image image_side;
-	sf::Image image_top;
+	TextureAtlas textures;
 
-	const LSVO<SVO_DEPTH>& svo;
+	const Volumetric& svo;
+	// Moving objects, queried with the static world when set
+	const Volumetric* dynamic_layer;
 
 	const sf::Vector2i render_size;
+	// Distance of the last primary hit of each pixel, 0 for the sky
+	std::vector<float> depths;
+
+	GodRays god_rays;
+	sf::Color god_rays_color = sf::Color(255, 244, 214);
 
 	glm::vec3 light_position;
+	// Angle covered by a pixel, same unit as Volumetric::castRay's ray_size_coef. Selects the texture mip levels.
+	float ray_size_coef = 0.0f;
 
 	sf::Color sky_color = sf::Color(119, 199, 242);
 
@@ -274,10 +507,22 @@ struct RayCaster
 	bool use_gi = false;
 	bool use_samples = false;
 	bool use_god_rays = false;
+	// Frames are rendered by WavefrontRenderer, one batched stage at a time
+	bool use_wavefront = false;
+	// Peripheral tiles are rendered at a reduced rate by Foveation
+	bool use_foveation = false;
+	// Foveation radii follow the render time instead, implies use_foveation
+	bool use_dynamic_resolution = false;
 	const uint32_t max_bounds = 4;
+	// Fraction of the light kept by each reflection, reflections stop when less than min_throughput would be left
+	const float mirror_reflectance = 0.8f;
+	const float min_throughput = 0.1f;
 	//const sf::Color sky_color = sf::Color(166, 215, 255);
 
 
 	const float focal_length = 1.0f;
 	const float aperture = 0.001f;
+
+private:
+	std::atomic<int32_t> m_reflection_budget{std::numeric_limits<int32_t>::max()};
 };
\ No newline at end of file
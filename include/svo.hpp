@@ -2,16 +2,22 @@
 
 #include "volumetric.hpp"
 #include "utils.hpp"
+#include <vector>
+#include <memory>
+#include <algorithm>
 
 
 struct Node
 {
+	// Children are never the root so index 0 is free to mean "no child"
+	static constexpr uint32_t None = 0u;
+
 	Node()
 	{
 		for (int x(0); x < 2; ++x) {
 			for (int y(0); y < 2; ++y) {
 				for (int z(0); z < 2; ++z) {
-					sub[x][y][z] = nullptr;
+					sub[x][y][z] = None;
 				}
 			}
 		}
@@ -19,12 +25,96 @@ struct Node
 		leaf = false;
 	}
 
-	Node* sub[2][2][2];
+	uint32_t sub[2][2][2];
 	bool leaf;
 	Cell cell;
 };
 
 
+// Chunked arena owning all the nodes of an SVO, children are referenced by index.
+// Chunks double in size from the first one up to CHUNK_SIZE so small trees don't allocate a full chunk.
+class NodePool
+{
+public:
+	static constexpr uint32_t CHUNK_SHIFT = 16u;
+	static constexpr uint32_t CHUNK_SIZE = 1u << CHUNK_SHIFT;
+	static constexpr uint32_t CHUNK_MASK = CHUNK_SIZE - 1u;
+
+	// first_chunk_shift can't be larger than CHUNK_SHIFT
+	NodePool(uint32_t first_chunk_shift = CHUNK_SHIFT)
+		: m_first_shift(std::min(first_chunk_shift, uint32_t(CHUNK_SHIFT)))
+		, m_capacity(0u)
+		, m_size(0u)
+	{}
+
+	uint32_t create()
+	{
+		if (m_size == m_capacity) {
+			// The first two chunks have the same size, each following one doubles the capacity until CHUNK_SIZE
+			const uint32_t chunk_size = (m_chunks.size() < 2u) ? (1u << m_first_shift) : std::min(m_capacity, uint32_t(CHUNK_SIZE));
+			m_chunks.emplace_back(new Node[chunk_size]);
+			m_capacity += chunk_size;
+		}
+
+		return m_size++;
+	}
+
+	// Releases all nodes at once, no per node destruction needed
+	void clear()
+	{
+		m_chunks.clear();
+		m_capacity = 0u;
+		m_size = 0u;
+	}
+
+	Node& operator[](uint32_t index)
+	{
+		return getNode(index);
+	}
+
+	const Node& operator[](uint32_t index) const
+	{
+		return getNode(index);
+	}
+
+	uint32_t size() const
+	{
+		return m_size;
+	}
+
+private:
+	std::vector<std::unique_ptr<Node[]>> m_chunks;
+	const uint32_t m_first_shift;
+	uint32_t m_capacity;
+	uint32_t m_size;
+
+	Node& getNode(uint32_t index) const
+	{
+		// Past the growing chunks all chunks have CHUNK_SIZE nodes, the growing ones cover [0, CHUNK_SIZE[
+		if (index >= CHUNK_SIZE) {
+			const uint32_t growing_chunk_count = CHUNK_SHIFT - m_first_shift + 1u;
+			return m_chunks[growing_chunk_count + (index >> CHUNK_SHIFT) - 1u][index & CHUNK_MASK];
+		}
+		if (index < (1u << m_first_shift)) {
+			return m_chunks[0][index];
+		}
+		// Growing chunk k > 0 starts at 2^(first_shift + k - 1), floor(log2(index)) is read from the float's exponent
+		const uint32_t level = (floatAsInt(float(index)) >> 23u) - 127u;
+		return m_chunks[level - m_first_shift + 1u][index - (1u << level)];
+	}
+};
+
+
+// Cube of cells to insert as a single leaf, code is the Morton code of its first cell.
+// A cube at depth d of a tree of depth N has a size of 2^(N - d), single cells are at depth N.
+struct MortonVoxel
+{
+	uint64_t code;
+	Cell cell;
+	uint8_t depth;
+};
+
+
 template<uint8_t N>
 class SVO
 {
@@ -33,48 +123,113 @@ public:
 	friend struct LSVO;
 
 	SVO()
+		// A full tree of depth N has about 8^N nodes, sparse ones much less
+		: m_nodes(std::min(3u * N, 12u))
 	{
-		m_root = new Node();
+		m_root = m_nodes.create();
 	}
 
-	~SVO()
+	void clear()
 	{
-		if (m_root) {
-			clear(m_root);
-		}
+		m_nodes.clear();
+		m_root = m_nodes.create();
 	}
 
-	void clear(Node* node)
+	const Node& getNode(uint32_t index) const
 	{
-		for (int x(0); x < 2; ++x) {
-			for (int y(0); y < 2; ++y) {
-				for (int z(0); z < 2; ++z) {
-					if (node->sub[x][y][z]) {
-						clear(node->sub[x][y][z]);
-					}
-				}
-			}
-		}
-
-		delete node;
+		return m_nodes[index];
 	}
 
 	HitPoint castRay(const glm::vec3& position, const glm::vec3& direction, const uint32_t max_iter) const
 	{
 		Ray ray(position, direction);
 
-		const uint32_t max_cell_size = uint32_t(std::pow(2, N - 1));
-		rec_castRay(ray, position, max_cell_size, m_root, max_iter);
+		const uint32_t max_cell_size = 1u << (N - 1);
+		rec_castRay(ray, position, max_cell_size, m_nodes[m_root], max_iter);
 
 		return ray.point;
 	}
 
 	void setCell(Cell::Type type, Cell::Texture texture, uint32_t x, uint32_t y, uint32_t z)
 	{
-		const uint32_t max_size = uint32_t(std::pow(2, N));
+		const uint32_t max_size = 1u << N;
 		rec_setCell(type, texture, x, y, z, m_root, max_size);
 	}
 
+	// Fills all the cells in [min, max[, nodes fully covered by the box become leaves
+	void fillBox(Cell::Type type, Cell::Texture texture, const glm::uvec3& min, const glm::uvec3& box_max)
+	{
+		// Cells outside of the root are ignored
+		const glm::uvec3 max = glm::min(box_max, glm::uvec3(1u << N));
+		if (min.x >= max.x || min.y >= max.y || min.z >= max.z) {
+			return;
+		}
+
+		Cell cell;
+		cell.type = type;
+		cell.texture = texture;
+		rec_fillBox(cell, min, max, m_root, glm::uvec3(0u), 1u << N);
+	}
+
+	// Fills the cells of the column (x, z) from y_min to y_max excluded
+	void fillColumn(Cell::Type type, Cell::Texture texture, uint32_t x, uint32_t z, uint32_t y_min, uint32_t y_max)
+	{
+		fillBox(type, texture, glm::uvec3(x, y_min, z), glm::uvec3(x + 1u, y_max, z + 1u));
+	}
+
+	// Voxels have to be sorted by Morton code and not overlap, consecutive voxels share their common descent path
+	// and finished subtrees are collapsed into leaves when all their children are identical
+	void insertSorted(const std::vector<MortonVoxel>& voxels)
+	{
+		uint32_t path[N + 1];
+		path[0] = m_root;
+		uint32_t path_depth = 0u;
+		uint64_t last_code = 0u;
+		for (const MortonVoxel& voxel : voxels) {
+			// Count common levels with the previous voxel
+			const uint64_t diff = voxel.code ^ last_code;
+			uint32_t shared = 0u;
+			while (shared < path_depth && shared < voxel.depth && !((diff >> (3u * (N - 1u - shared))) & 7u)) {
+				++shared;
+			}
+			// Subtrees we are leaving are complete
+			for (uint32_t d(path_depth); d > shared; --d) {
+				tryCollapse(path[d]);
+			}
+
+			path_depth = shared;
+			while (path_depth < voxel.depth) {
+				Node& node = m_nodes[path[path_depth]];
+				if (node.leaf) {
+					if (node.cell == voxel.cell) {
+						break;
+					}
+					split(path[path_depth]);
+				}
+
+				const uint32_t child = (voxel.code >> (3u * (N - 1u - path_depth))) & 7u;
+				uint32_t& sub_index = node.sub[child & 1u][(child >> 1u) & 1u][child >> 2u];
+				if (sub_index == Node::None) {
+					sub_index = m_nodes.create();
+				}
+				path[++path_depth] = sub_index;
+			}
+
+			if (!voxel.depth) {
+				// The root stays a node, only its children become leaves
+				fillBox(voxel.cell.type, voxel.cell.texture, glm::uvec3(0u), glm::uvec3(1u << N));
+			}
+			else if (path_depth == voxel.depth) {
+				setLeaf(m_nodes[path[path_depth]], voxel.cell);
+			}
+			last_code = voxel.code;
+		}
+
+		for (uint32_t d(path_depth); d > 0u; --d) {
+			tryCollapse(path[d]);
+		}
+	}
+
 	inline static bool checkCell(const glm::vec3& cell_coords)
 	{
 		return cell_coords.x >= 0 &&
@@ -85,38 +240,121 @@ public:
 			   cell_coords.z < 2;
 	}
 
-	Node* m_root;
+	NodePool m_nodes;
+	uint32_t m_root;
 
 private:
-	void rec_setCell(Cell::Type type, Cell::Texture texture, uint32_t x, uint32_t y, uint32_t z, Node* node, uint32_t size)
+	void setLeaf(Node& node, const Cell& cell)
 	{
-		if (!node) {
-			return;
+		// Previous children are left in the pool, they will be released with it
+		node = Node();
+		node.leaf = true;
+		node.cell = cell;
+	}
+
+	// Turns a leaf covering more than one cell back into a node with 8 identical leaves
+	void split(uint32_t node_index)
+	{
+		Node& node = m_nodes[node_index];
+		node.leaf = false;
+		for (uint32_t i(0u); i < 8u; ++i) {
+			const uint32_t sub_index = m_nodes.create();
+			setLeaf(m_nodes[sub_index], node.cell);
+			node.sub[i & 1u][(i >> 1u) & 1u][i >> 2u] = sub_index;
+		}
+	}
+
+	// Replaces a node by a single leaf if its 8 children are identical leaves
+	bool tryCollapse(uint32_t node_index)
+	{
+		Node& node = m_nodes[node_index];
+		const uint32_t first = node.sub[0][0][0];
+		if (node.leaf || first == Node::None || !m_nodes[first].leaf) {
+			return false;
+		}
+
+		const Cell cell = m_nodes[first].cell;
+		for (uint32_t i(1u); i < 8u; ++i) {
+			const uint32_t sub_index = node.sub[i & 1u][(i >> 1u) & 1u][i >> 2u];
+			if (sub_index == Node::None || !m_nodes[sub_index].leaf || !(m_nodes[sub_index].cell == cell)) {
+				return false;
+			}
+		}
+
+		setLeaf(node, cell);
+		return true;
+	}
+
+	void rec_fillBox(const Cell& cell, const glm::uvec3& min, const glm::uvec3& max, uint32_t node_index, const glm::uvec3& node_pos, uint32_t size)
+	{
+		const uint32_t sub_size = size >> 1u;
+		const glm::uvec3 center = node_pos + sub_size;
+		// Range of children overlapping the box on each axis
+		const uint32_t x_min = min.x < center.x ? 0u : 1u, x_max = max.x > center.x ? 1u : 0u;
+		const uint32_t y_min = min.y < center.y ? 0u : 1u, y_max = max.y > center.y ? 1u : 0u;
+		const uint32_t z_min = min.z < center.z ? 0u : 1u, z_max = max.z > center.z ? 1u : 0u;
+		for (uint32_t x(x_min); x <= x_max; ++x) {
+			for (uint32_t y(y_min); y <= y_max; ++y) {
+				for (uint32_t z(z_min); z <= z_max; ++z) {
+					uint32_t& sub_index = m_nodes[node_index].sub[x][y][z];
+					if (sub_index == Node::None) {
+						sub_index = m_nodes.create();
+					}
+
+					Node& sub_node = m_nodes[sub_index];
+					const glm::uvec3 sub_pos = node_pos + sub_size * glm::uvec3(x, y, z);
+					const glm::uvec3 sub_end = sub_pos + sub_size;
+					if (sub_pos.x >= min.x && sub_pos.y >= min.y && sub_pos.z >= min.z &&
+						sub_end.x <= max.x && sub_end.y <= max.y && sub_end.z <= max.z) {
+						setLeaf(sub_node, cell);
+					}
+					else if (!sub_node.leaf || !(sub_node.cell == cell)) {
+						if (sub_node.leaf) {
+							split(sub_index);
+						}
+						rec_fillBox(cell, min, max, sub_index, sub_pos, sub_size);
+						tryCollapse(sub_index);
+					}
+				}
+			}
 		}
+	}
 
+	void rec_setCell(Cell::Type type, Cell::Texture texture, uint32_t x, uint32_t y, uint32_t z, uint32_t node_index, uint32_t size)
+	{
+		Node& node = m_nodes[node_index];
 		if (size == 1) {
-			node->cell.type = type;
-			node->cell.texture = texture;
-			node->leaf = true;
+			node.cell.type = type;
+			node.cell.texture = texture;
+			node.leaf = true;
 			return;
 		}
 
+		if (node.leaf) {
+			if (node.cell.type == type && node.cell.texture == texture) {
+				return;
+			}
+			split(node_index);
+		}
+
 		const uint32_t sub_size = size / 2;
 		const uint32_t cell_x = x / sub_size;
 		const uint32_t cell_y = y / sub_size;
 		const uint32_t cell_z = z / sub_size;
 
-		if (!node->sub[cell_x][cell_y][cell_z]) {
-			node->sub[cell_x][cell_y][cell_z] = new Node();
+		// Chunks are never moved so this reference stays valid when the pool grows
+		uint32_t& sub_index = node.sub[cell_x][cell_y][cell_z];
+		if (sub_index == Node::None) {
+			sub_index = m_nodes.create();
 		}
 
-		rec_setCell(type, texture, x - cell_x * sub_size, y - cell_y * sub_size, z - cell_z * sub_size, node->sub[cell_x][cell_y][cell_z], sub_size);
+		rec_setCell(type, texture, x - cell_x * sub_size, y - cell_y * sub_size, z - cell_z * sub_size, sub_index, sub_size);
 	}
 
-	void fillHitResult(Ray& ray, const Node* node, const float t) const
+	void fillHitResult(Ray& ray, const Node& node, const float t) const
 	{
 		/*HitPoint& point = ray.point;
-		const Cell& cell = node->cell;
+		const Cell& cell = node.cell;
 		const glm::vec3 hit = ray.start + t * ray.direction;
 
 		point.cell = &cell;
@@ -137,7 +375,7 @@ private:
 		}*/
 	}
 
-	void rec_castRay(Ray& ray, const glm::vec3& position, uint32_t cell_size, const Node* node, const uint32_t max_iter) const
+	void rec_castRay(Ray& ray, const glm::vec3& position, uint32_t cell_size, const Node& node, const uint32_t max_iter) const
 	{
 		glm::vec3 cell_pos_i = glm::ivec3(position.x / cell_size, position.y / cell_size, position.z / cell_size);
 		clamp(cell_pos_i.x, 0.0f, 1.0f);
@@ -153,9 +391,10 @@ private:
 			// Increase pixel complexity
 			++ray.point.complexity;
 			// We enter the sub node
-			const Node* sub_node = node->sub[uint32_t(cell_pos_i.x)][uint32_t(cell_pos_i.y)][uint32_t(cell_pos_i.z)];
-			if (sub_node) {
-				if (sub_node->leaf) {
+			const uint32_t sub_index = node.sub[uint32_t(cell_pos_i.x)][uint32_t(cell_pos_i.y)][uint32_t(cell_pos_i.z)];
+			if (sub_index != Node::None) {
+				const Node& sub_node = m_nodes[sub_index];
+				if (sub_node.leaf) {
 					fillHitResult(ray, sub_node, t_total + t_max_min);
 					return;
 				}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include "svo.hpp"
+#include "fastnoise/FastNoise.h"
+
+
+// Heightfield terrain, the heights of a brick's columns are evaluated in one FillNoiseSet batch
+// and each column is inserted with a single fillColumn
+template<uint8_t N>
+struct TerrainGenerator
+{
+	static constexpr uint32_t SIZE = 1u << N;
+
+	TerrainGenerator()
+		: noise_scale(0.75f)
+		, amplitude(64.0f)
+		, base_height(32)
+		, ground_level(16)
+		, max_height(SIZE / 2u)
+		, y_offset(SIZE / 2u)
+	{}
+
+	// Fills the SVO of a brick of the world, origin is the position of its first voxel in world voxel coordinates.
+	// The heightfield is unbounded on x and z so origin can be negative.
+	template<uint8_t B>
+	void generateBrick(SVO<B>& svo, const glm::ivec3& origin) const
+	{
+		constexpr int32_t brick_size = 1 << B;
+		// Skip noise evaluation for bricks fully above or below the terrain's possible range
+		const int32_t terrain_min = 1 + int32_t(y_offset);
+		const int32_t terrain_max = std::max(ground_level, max_height) + int32_t(y_offset);
+		if (origin.y >= terrain_max || origin.y + brick_size <= terrain_min) {
+			return;
+		}
+
+		std::vector<FN_DECIMAL> noise_set(brick_size * brick_size);
+		noise.FillNoiseSet(&noise_set[0], noise_scale * origin.x, noise_scale * origin.z, brick_size, brick_size, noise_scale);
+		const int32_t y_min = std::max(terrain_min, origin.y) - origin.y;
+		for (int32_t x(0); x < brick_size; ++x) {
+			for (int32_t z(0); z < brick_size; ++z) {
+				const int32_t column_max = std::max(1, getHeight(noise_set[x * brick_size + z])) + int32_t(y_offset);
+				const int32_t y_max = std::min(column_max, origin.y + brick_size) - origin.y;
+				if (y_max > y_min) {
+					svo.fillColumn(Cell::Solid, Cell::Grass, uint32_t(x), uint32_t(z), uint32_t(y_min), uint32_t(y_max));
+				}
+			}
+		}
+	}
+
+	int32_t getHeight(FN_DECIMAL noise_value) const
+	{
+		const int32_t height = int32_t(amplitude * noise_value + base_height);
+		return std::max(ground_level, std::min(max_height, height));
+	}
+
+	FastNoise noise;
+	float noise_scale;
+	float amplitude;
+	int32_t base_height;
+	int32_t ground_level;
+	int32_t max_height;
+	uint32_t y_offset;
+};
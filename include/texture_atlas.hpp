@@ -0,0 +1,128 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <SFML/Graphics.hpp>
+#include <glm/glm.hpp>
+#include "cell.hpp"
+#include "utils.hpp"
+
+
+// All block textures in one buffer of float texels in [0, 1], each tile directly followed by its mip levels.
+// Values are the 8 bits ones rescaled, they are the intensities the shading treats as linear.
+// Faces are indexed like FaceOcclusion: axis * 2 + 1 if they look toward +axis.
+struct TextureAtlas
+{
+	static constexpr uint32_t TILE_SIZE = 16u;
+	// From TILE_SIZE down to 1
+	static constexpr uint32_t LEVEL_COUNT = 5u;
+	static constexpr uint32_t TILE_TEXELS = (TILE_SIZE * TILE_SIZE * 4u - 1u) / 3u;
+	static constexpr uint32_t MATERIAL_COUNT = Cell::White + 1u;
+	static constexpr uint32_t FACE_COUNT = 6u;
+
+	TextureAtlas()
+		: m_faces(MATERIAL_COUNT * FACE_COUNT, 0u)
+	{
+		// Tile 0 is used by materials without texture and files that failed to load
+		addTile(sf::Color::Magenta);
+	}
+
+	uint32_t addTile(const sf::Image& image)
+	{
+		const sf::Vector2u image_size = image.getSize();
+		if (!image_size.x || !image_size.y) {
+			return 0u;
+		}
+
+		const uint32_t tile = uint32_t(m_texels.size() / TILE_TEXELS);
+		m_texels.resize(m_texels.size() + TILE_TEXELS);
+		glm::vec3* texels = &m_texels[tile * TILE_TEXELS];
+		// Images of another size are resampled to the nearest texel
+		for (uint32_t y(0u); y < TILE_SIZE; ++y) {
+			for (uint32_t x(0u); x < TILE_SIZE; ++x) {
+				const sf::Color color = image.getPixel(x * image_size.x / TILE_SIZE, y * image_size.y / TILE_SIZE);
+				texels[y * TILE_SIZE + x] = glm::vec3(color.r, color.g, color.b) / 255.0f;
+			}
+		}
+		generateLevels(texels);
+		return tile;
+	}
+
+	uint32_t addTile(const sf::Color& color)
+	{
+		sf::Image image;
+		image.create(1u, 1u, color);
+		return addTile(image);
+	}
+
+	uint32_t loadTile(const std::string& filename)
+	{
+		sf::Image image;
+		if (!image.loadFromFile(filename)) {
+			return 0u;
+		}
+		return addTile(image);
+	}
+
+	// Top tile goes on both horizontal faces
+	void setMaterial(Cell::Texture material, uint32_t side_tile, uint32_t top_tile)
+	{
+		for (uint32_t face(0u); face < FACE_COUNT; ++face) {
+			m_faces[material * FACE_COUNT + face] = ((face >> 1u) == 1u ? top_tile : side_tile) * TILE_TEXELS;
+		}
+	}
+
+	// Normals have a single non zero component, a zero normal gives face 0
+	static uint32_t getFace(const glm::vec3& normal)
+	{
+		const uint32_t axis = uint32_t(normal.y != 0.0f) + 2u * uint32_t(normal.z != 0.0f);
+		return 2u * axis + uint32_t(normal.x + normal.y + normal.z > 0.0f);
+	}
+
+	// Coarsest level whose texels aren't larger than the footprint, given in texels of level 0.
+	// This is floor(log2(footprint)) read from the float's exponent.
+	static uint32_t getLevel(float footprint)
+	{
+		const int32_t exponent = int32_t(floatAsInt(footprint) >> 23u) - 127;
+		return uint32_t(std::max(0, exponent));
+	}
+
+	// Nearest texel of the given mip level, uv is clamped to [0, 1]
+	glm::vec3 sample(Cell::Texture material, uint32_t face, const glm::vec2& uv, uint32_t level = 0u) const
+	{
+		level = std::min(level, uint32_t(LEVEL_COUNT - 1u));
+		const uint32_t size = TILE_SIZE >> level;
+		const uint32_t x = std::min(uint32_t(std::max(uv.x, 0.0f) * float(size)), size - 1u);
+		const uint32_t y = std::min(uint32_t(std::max(uv.y, 0.0f) * float(size)), size - 1u);
+		return m_texels[m_faces[material * FACE_COUNT + face] + getLevelOffset(level) + y * size + x];
+	}
+
+private:
+	// Offset of each face's tile, in texels
+	std::vector<uint32_t> m_faces;
+	std::vector<glm::vec3> m_texels;
+
+	// Sum of the sizes of the previous levels, a geometric series of ratio 1/4
+	static uint32_t getLevelOffset(uint32_t level)
+	{
+		constexpr uint32_t SERIES_LIMIT = TILE_SIZE * TILE_SIZE * 4u;
+		return (SERIES_LIMIT - (SERIES_LIMIT >> (2u * level))) / 3u;
+	}
+
+	// Box filters each level from the previous one
+	static void generateLevels(glm::vec3* texels)
+	{
+		for (uint32_t level(1u); level < LEVEL_COUNT; ++level) {
+			const uint32_t size = TILE_SIZE >> level;
+			const glm::vec3* source = texels + getLevelOffset(level - 1u);
+			glm::vec3* destination = texels + getLevelOffset(level);
+			for (uint32_t y(0u); y < size; ++y) {
+				for (uint32_t x(0u); x < size; ++x) {
+					const uint32_t index = 2u * y * (2u * size) + 2u * x;
+					destination[y * size + x] = 0.25f * (source[index] + source[index + 1u] + source[index + 2u * size] + source[index + 2u * size + 1u]);
+				}
+			}
+		}
+	}
+};
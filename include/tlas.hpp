@@ -0,0 +1,131 @@
+#pragma once
+
+#include <vector>
+#include "bvh.hpp"
+#include "brick_grid.hpp"
+
+
+// Placement of a shared voxel model, the model's [1, 2] volume is scaled to a cube of side scale,
+// rotated around its first corner and moved to position (in render space)
+template<uint8_t MODEL_DEPTH>
+struct Instance
+{
+	Instance()
+		: model(nullptr)
+		, position(0.0f)
+		, rotation(1.0f)
+		, scale(1.0f)
+	{}
+
+	Instance(const LSVO<MODEL_DEPTH>* model_, const glm::vec3& position_, const glm::mat3& rotation_, float scale_)
+		: model(model_)
+		, position(position_)
+		, rotation(rotation_)
+		, scale(scale_)
+	{}
+
+	AABB getBounds() const
+	{
+		AABB box;
+		for (uint8_t i(0u); i < 8u; ++i) {
+			const glm::vec3 corner(float(i & 1u), float((i >> 1u) & 1u), float(i >> 2u));
+			box.grow(position + rotation * (corner * scale));
+		}
+		return box;
+	}
+
+	const LSVO<MODEL_DEPTH>* model;
+	glm::vec3 position;
+	// Must be orthonormal
+	glm::mat3 rotation;
+	float scale;
+};
+
+
+// Top level acceleration structure, a BVH over instances of LSVO models.
+// Models are shared between instances so memory scales with unique models, not with placements.
+template<uint8_t MODEL_DEPTH>
+struct TLAS : public Volumetric
+{
+	// Has to be called after instances have been added, removed or moved
+	void build()
+	{
+		updateBoxes();
+		m_bvh.build(m_boxes);
+	}
+
+	// Only updates bounds, for instances that moved since the last build. Traversal gets slower as
+	// instances drift away from their initial neighbors so the tree should be rebuilt from time to time.
+	void refit()
+	{
+		updateBoxes();
+		m_bvh.refit(m_boxes);
+	}
+
+	void setCell(Cell::Type type, Cell::Texture texture, uint32_t x, uint32_t y, uint32_t z) {}
+
+	HitPoint castRay(const glm::vec3& position, glm::vec3 d, const float ray_size_coef = 0.0f, const float ray_size_bias = 0.0f) const override
+	{
+		HitPoint result;
+		constexpr float EPS = 1.0f / float(1 << 23);
+		if (std::abs(d.x) < EPS) { d.x = copysign(EPS, d.x); }
+		if (std::abs(d.y) < EPS) { d.y = copysign(EPS, d.y); }
+		if (std::abs(d.z) < EPS) { d.z = copysign(EPS, d.z); }
+
+		float t_closest = std::numeric_limits<float>::max();
+		m_bvh.traverse(position, d, t_closest, [&](uint32_t i, float& t_max) {
+			castRayInInstance(instances[i], position, d, ray_size_coef, ray_size_bias, t_max, result);
+		});
+
+		return result;
+	}
+
+	std::vector<Instance<MODEL_DEPTH>> instances;
+
+protected:
+	BVH m_bvh;
+	std::vector<AABB> m_boxes;
+
+	void updateBoxes()
+	{
+		const uint32_t instance_count = uint32_t(instances.size());
+		m_boxes.resize(instance_count);
+		for (uint32_t i(0u); i < instance_count; ++i) {
+			m_boxes[i] = instances[i].getBounds();
+		}
+	}
+
+	// The ray is cast in the instance's space where its model covers one grid cell, hits farther than t_max are ignored
+	static void castRayInInstance(const Instance<MODEL_DEPTH>& instance, const glm::vec3& position, const glm::vec3& d, float ray_size_coef, float ray_size_bias, float& t_max, HitPoint& result)
+	{
+		const float inv_scale = 1.0f / instance.scale;
+		// Inverse rotation, the rotation is orthonormal so the direction keeps its length
+		const glm::vec3 start = ((position - instance.position) * instance.rotation) * inv_scale;
+		const glm::vec3 local_d = d * instance.rotation;
+		const glm::vec3 inv_d = 1.0f / local_d;
+		const glm::vec3 t_0 = -start * inv_d;
+		const glm::vec3 t_1 = (1.0f - start) * inv_d;
+		const glm::vec3 t_near = glm::min(t_0, t_1);
+		const glm::vec3 t_far = glm::max(t_0, t_1);
+		const float t = std::max(0.0f, std::max(t_near.x, std::max(t_near.y, t_near.z)));
+		const float t_limit = std::min(t_max * inv_scale, std::min(t_far.x, std::min(t_far.y, t_far.z)));
+		if (t > t_limit) {
+			return;
+		}
+
+		GridDDA dda(start, local_d, t, t > 0.0f ? getEntryMask(t_near) : 0u);
+		dda.clampCell(glm::ivec3(0), glm::ivec3(0));
+		HitPoint hit;
+		hit.complexity = result.complexity;
+		if (castRayInBrick(*instance.model, start, local_d, dda, t_limit, t_limit, ray_size_coef, ray_size_bias * inv_scale, hit)) {
+			hit.distance *= instance.scale;
+			hit.position = instance.position + instance.rotation * (hit.position * instance.scale);
+			hit.normal = instance.rotation * hit.normal;
+			t_max = hit.distance;
+			result = hit;
+		}
+		else {
+			result.complexity = hit.complexity;
+		}
+	}
+};
@@ -12,6 +12,9 @@ void mult(sf::Color& color, float f);
 
 void mult(sf::Color& color1, const sf::Color& color2);
 
+// Components are clamped to [0, 1] before being scaled to 8 bits
+sf::Color toColor(const glm::vec3& color);
+
 float frac(float f);
 
 void clamp(float& value, float min, float max);
@@ -27,3 +30,5 @@ std::string toString(const glm::vec3& vec);
 uint32_t floatAsInt(float f);
 
 float intAsFloat(uint32_t i);
+
+uint64_t mortonEncode(uint32_t x, uint32_t y, uint32_t z);
@@ -9,6 +9,7 @@ struct HitPoint
 	HitPoint()
 		: cell(nullptr)
 		, complexity(0u)
+		, occlusion(0u)
 	{}
 
 	glm::vec3 position;
@@ -19,6 +20,8 @@ struct HitPoint
 	float distance;
 
 	uint32_t complexity;
+	// Baked occlusion of the hit face's corners, 2 bits per corner (see FaceOcclusion), 0 when not available
+	uint8_t occlusion;
 };
 
 
@@ -52,10 +55,36 @@ struct Ray
 };
 
 
+// Decides if rays bounce on the mirrors they hit, see Volumetric::castMirroredRay
+struct MirrorHandler
+{
+	virtual ~MirrorHandler() = default;
+
+	// Called on the hits of mirror cells that have a normal, start and direction are the ray that hit in the volume's
+	// space. Returns true if the ray bounces, start and direction are then set to the reflected ray.
+	virtual bool onMirrorHit(const HitPoint& hit, glm::vec3& start, glm::vec3& direction) = 0;
+};
+
+
 class Volumetric
 {
 public:
-	virtual HitPoint castRay(const glm::vec3& position, glm::vec3 direction, const float, const float) const = 0;
+	virtual HitPoint castRay(const glm::vec3& position, glm::vec3 direction, const float ray_size_coef = 0.0f, const float ray_size_bias = 0.0f) const = 0;
 	virtual void setCell(Cell::Type type, Cell::Texture texture, uint32_t x, uint32_t y, uint32_t z) = 0;
 
+	// castRay following the mirrors the handler reflects the ray on, the last hit is returned with the complexity of the
+	// whole path and its distance from the last reflection. Reflected rays are cast from scratch here, volumes able to
+	// resume their traversal from the mirror override it.
+	virtual HitPoint castMirroredRay(glm::vec3 position, glm::vec3 direction, float ray_size_coef, float ray_size_bias, MirrorHandler& mirrors) const
+	{
+		HitPoint result = castRay(position, direction, ray_size_coef, ray_size_bias);
+		uint32_t complexity = result.complexity;
+		while (result.cell && result.cell->type == Cell::Mirror && result.normal != glm::vec3(0.0f) && mirrors.onMirrorHit(result, position, direction)) {
+			ray_size_bias += result.distance * ray_size_coef;
+			result = castRay(position, direction, ray_size_coef, ray_size_bias);
+			complexity += result.complexity;
+		}
+		result.complexity = complexity;
+		return result;
+	}
 };
@@ -0,0 +1,442 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+#include "raycaster.hpp"
+#include "camera_controller.hpp"
+#include "swarm/swarm.hpp"
+
+
+// Rays stored component by component so each stage streams through contiguous arrays
+struct RayBuffer
+{
+	RayBuffer()
+		: count(0u)
+	{}
+
+	// Never shrinks so buffers stop allocating once they reached their largest size
+	void reserve(uint32_t size)
+	{
+		if (owner.size() < size) {
+			origin_x.resize(size);
+			origin_y.resize(size);
+			origin_z.resize(size);
+			direction_x.resize(size);
+			direction_y.resize(size);
+			direction_z.resize(size);
+			owner.resize(size);
+			weight.resize(size);
+			size_coef.resize(size);
+			throughput.resize(size);
+		}
+	}
+
+	void set(uint32_t i, const glm::vec3& origin, const glm::vec3& direction, uint32_t owner_, float weight_ = 0.0f, float size_coef_ = 0.0f, float throughput_ = 1.0f)
+	{
+		origin_x[i] = origin.x;
+		origin_y[i] = origin.y;
+		origin_z[i] = origin.z;
+		direction_x[i] = direction.x;
+		direction_y[i] = direction.y;
+		direction_z[i] = direction.z;
+		owner[i] = owner_;
+		weight[i] = weight_;
+		size_coef[i] = size_coef_;
+		throughput[i] = throughput_;
+	}
+
+	void copy(uint32_t i, const RayBuffer& source, uint32_t source_index)
+	{
+		set(i, source.getOrigin(source_index), source.getDirection(source_index), source.owner[source_index], source.weight[source_index], source.size_coef[source_index], source.throughput[source_index]);
+	}
+
+	glm::vec3 getOrigin(uint32_t i) const
+	{
+		return glm::vec3(origin_x[i], origin_y[i], origin_z[i]);
+	}
+
+	glm::vec3 getDirection(uint32_t i) const
+	{
+		return glm::vec3(direction_x[i], direction_y[i], direction_z[i]);
+	}
+
+	std::vector<float> origin_x;
+	std::vector<float> origin_y;
+	std::vector<float> origin_z;
+	std::vector<float> direction_x;
+	std::vector<float> direction_y;
+	std::vector<float> direction_z;
+	// Pixel for primary rays, lighting slot for shadow rays, primary ray for GI rays
+	std::vector<uint32_t> owner;
+	// Light added to the owner's slot if a shadow ray reaches the light, cosine with the surface's normal for GI rays
+	std::vector<float> weight;
+	// ray_size_coef the ray is traced with
+	std::vector<float> size_coef;
+	// Attenuation of the path, GI rays only
+	std::vector<float> throughput;
+	uint32_t count;
+};
+
+
+// Renders the same image as RayCaster::renderRay but one stage at a time for all the rays of the frame:
+// primary rays are generated then traced, following mirrors within their traversal,
+// the rays that hit are compacted and shaded, shading emits
+// shadow and GI rays in their own queues. Each GI bounce is a stage whose hits emit a shadow ray and the
+// rays of the next bounce, all shadow rays are traced together at the end.
+// Each stage is one batch on the swarm, threads work on contiguous slices.
+struct WavefrontRenderer
+{
+	// Bits per axis of the origins' cells, bins are made of a direction octant and an origin cell
+	static constexpr uint32_t ORIGIN_BITS = 3u;
+	static constexpr uint32_t BIN_BITS = 3u + 3u * ORIGIN_BITS;
+
+	WavefrontRenderer(RayCaster& raycaster_, swrm::Swarm& swarm_, uint32_t thread_count)
+		: raycaster(raycaster_)
+		, bin_gi_rays(false)
+		, bin_min(1.0f)
+		, bin_max(2.0f)
+		, gi_time(0.0f)
+		, m_swarm(swarm_)
+		, m_histograms(thread_count << BIN_BITS, 0u)
+		, m_slice_counts(thread_count, 0u)
+		, m_gi_slice_counts(thread_count, 0u)
+	{}
+
+	// Renders the pixels of the checker board, camera position is in world voxels and scale converts it to render space
+	void render(Camera& camera, float scale, int32_t checker_board_offset)
+	{
+		const sf::Vector2i& size = raycaster.render_size;
+		// One ray every other pixel of each row
+		const uint32_t ray_count = uint32_t((size.x + 1) / 2 * size.y);
+		m_primary.reserve(ray_count);
+		m_hits.resize(std::max(uint32_t(m_hits.size()), ray_count));
+		m_depths.resize(std::max(uint32_t(m_depths.size()), ray_count));
+		m_throughputs.resize(std::max(uint32_t(m_throughputs.size()), ray_count));
+		m_path_lengths.resize(std::max(uint32_t(m_path_lengths.size()), ray_count));
+		m_reflections.resize(std::max(uint32_t(m_reflections.size()), ray_count));
+		m_shading.resize(std::max(uint32_t(m_shading.size()), ray_count));
+		// Direct light then one slot per GI bounce for each primary ray
+		m_bounce_count = uint32_t(raycaster.use_gi ? raycaster.getGIBounceCount(RayContext()) : 0);
+		m_slot_count = 1u + m_bounce_count;
+		m_lighting.resize(std::max(uint32_t(m_lighting.size()), m_slot_count * ray_count));
+		m_hit_queue.resize(std::max(uint32_t(m_hit_queue.size()), ray_count));
+		m_shadow_candidates.reserve(ray_count);
+		m_gi_candidates.reserve(ray_count);
+		m_shadow_queue.reserve(m_slot_count * ray_count);
+		m_gi_queue.reserve(ray_count);
+
+		generatePrimaryRays(camera, scale, checker_board_offset, ray_count);
+		tracePrimaryRays();
+		compactHits();
+		shadeHits();
+		compactCandidates(m_shadow_candidates, m_slice_counts, m_hit_count, m_shadow_queue, 0u);
+		compactCandidates(m_gi_candidates, m_gi_slice_counts, m_hit_count, m_gi_queue, 0u);
+		sf::Clock gi_clock;
+		for (uint32_t bounce(0u); bounce < m_bounce_count && m_gi_queue.count; ++bounce) {
+			if (bin_gi_rays) {
+				binRays(m_gi_queue);
+			}
+			const uint32_t gi_count = m_gi_queue.count;
+			traceGIRays(bounce);
+			compactCandidates(m_shadow_candidates, m_slice_counts, gi_count, m_shadow_queue, m_shadow_queue.count);
+			// The queue has been fully read, the next bounce replaces it
+			compactCandidates(m_gi_candidates, m_gi_slice_counts, gi_count, m_gi_queue, 0u);
+		}
+		gi_time = gi_clock.getElapsedTime().asSeconds();
+		traceShadowRays();
+		resolve();
+	}
+
+	RayCaster& raycaster;
+	// GI rays have random directions, grouping them by direction and origin lets neighbor rays reuse the same nodes.
+	// Off by default as it only pays with bins following the loaded world, bench/wavefront_binning.cpp measures it.
+	bool bin_gi_rays;
+	// Render space volume origins are binned in, it should follow the loaded world (see ChunkedWorld::getWindowMin)
+	glm::vec3 bin_min;
+	glm::vec3 bin_max;
+	// Seconds spent in the GI bounces of the last frame, binning included
+	float gi_time;
+
+private:
+	swrm::Swarm& m_swarm;
+	RayBuffer m_primary;
+	// Last hit of each primary ray once mirrors have been followed
+	std::vector<HitPoint> m_hits;
+	// Distance of the first hit, 0 for the sky
+	std::vector<float> m_depths;
+	// Attenuation, distance covered and number of reflections before the last hit
+	std::vector<float> m_throughputs;
+	std::vector<float> m_path_lengths;
+	std::vector<uint8_t> m_reflections;
+	// Albedo with ambient occlusion and reflections' attenuation of each primary ray
+	std::vector<glm::vec3> m_shading;
+	std::vector<float> m_lighting;
+	uint32_t m_bounce_count;
+	uint32_t m_slot_count;
+	std::vector<uint32_t> m_hit_queue;
+	uint32_t m_hit_count;
+	// Rays emitted by a stage at the index of the item that emitted them, weight is negative for missing rays
+	RayBuffer m_shadow_candidates;
+	RayBuffer m_gi_candidates;
+	RayBuffer m_shadow_queue;
+	RayBuffer m_gi_queue;
+	// Binning state, the binned copy is swapped with the queue
+	RayBuffer m_binned;
+	std::vector<uint16_t> m_keys;
+	// One histogram per thread, then the first output index of each of its bins
+	std::vector<uint32_t> m_histograms;
+	// Number of valid items in each thread's slice, filled by the stage producing them
+	std::vector<uint32_t> m_slice_counts;
+	std::vector<uint32_t> m_gi_slice_counts;
+
+	static uint32_t getSliceBegin(uint32_t count, uint32_t thread_id, uint32_t max_thread)
+	{
+		return uint32_t(uint64_t(count) * thread_id / max_thread);
+	}
+
+	template<typename Kernel>
+	void runStage(uint32_t count, Kernel kernel)
+	{
+		m_swarm.execute([&](uint32_t thread_id, uint32_t max_thread) {
+			kernel(getSliceBegin(count, thread_id, max_thread), getSliceBegin(count, thread_id + 1u, max_thread), thread_id);
+		}, uint32_t(m_slice_counts.size())).waitExecutionDone();
+	}
+
+	void generatePrimaryRays(Camera& camera, float scale, int32_t checker_board_offset, uint32_t ray_count)
+	{
+		const sf::Vector2i& size = raycaster.render_size;
+		const float aspect_ratio = float(size.x) / float(size.y);
+		const uint32_t row_count = uint32_t(size.x + 1) / 2u;
+		runStage(ray_count, [&](uint32_t begin, uint32_t end, uint32_t thread_id) {
+			for (uint32_t i(begin); i < end; ++i) {
+				// Rows alternate their first pixel, the last one is repeated on rows of odd width
+				const uint32_t y = i / row_count;
+				const uint32_t x = std::min(2u * (i % row_count) + ((y + checker_board_offset) & 1u), uint32_t(size.x - 1));
+				const uint32_t pixel = y * size.x + x;
+				const float lens_x = float(x) / float(size.y) - aspect_ratio * 0.5f;
+				const float lens_y = float(y) / float(size.y) - 0.5f;
+				const CameraRay camera_ray = camera.getRay(glm::vec2(lens_x, lens_y));
+				m_primary.set(i, (camera.position + camera_ray.world_rand_offset) * scale + glm::vec3(1.0f), camera_ray.ray, pixel);
+			}
+		});
+		m_primary.count = ray_count;
+	}
+
+	// The primary ray buffer is updated with the last reflected ray of each primary ray
+	void tracePrimaryRays()
+	{
+		runStage(m_primary.count, [&](uint32_t begin, uint32_t end, uint32_t thread_id) {
+			for (uint32_t i(begin); i < end; ++i) {
+				RayCaster::MirrorPath path(raycaster, m_primary.getOrigin(i), m_primary.getDirection(i), 0u);
+				m_hits[i] = raycaster.intersect(path);
+				m_depths[i] = path.getDepth(m_hits[i]);
+				m_throughputs[i] = path.throughput;
+				m_path_lengths[i] = path.path_length;
+				m_reflections[i] = uint8_t(path.reflection_count);
+				if (path.reflection_count) {
+					m_primary.set(i, path.start, path.direction, m_primary.owner[i]);
+				}
+			}
+		});
+	}
+
+	// GI bounces left to a primary ray after its reflections
+	uint32_t getGIBounceCount(uint32_t i) const
+	{
+		RayContext context;
+		context.bounds = m_reflections[i];
+		return raycaster.use_gi ? uint32_t(raycaster.getGIBounceCount(context)) : 0u;
+	}
+
+	void compactHits()
+	{
+		runStage(m_primary.count, [&](uint32_t begin, uint32_t end, uint32_t thread_id) {
+			uint32_t hit_count = 0u;
+			for (uint32_t i(begin); i < end; ++i) {
+				hit_count += m_hits[i].cell != nullptr;
+			}
+			m_slice_counts[thread_id] = hit_count;
+		});
+		runStage(m_primary.count, [&](uint32_t begin, uint32_t end, uint32_t thread_id) {
+			uint32_t index = getOutputIndex(m_slice_counts, thread_id);
+			for (uint32_t i(begin); i < end; ++i) {
+				if (m_hits[i].cell) {
+					m_hit_queue[index++] = i;
+				}
+			}
+		});
+		m_hit_count = getOutputIndex(m_slice_counts, uint32_t(m_slice_counts.size()));
+	}
+
+	// Albedo and occlusion, emits one shadow ray and one GI ray per hit
+	void shadeHits()
+	{
+		runStage(m_hit_count, [&](uint32_t begin, uint32_t end, uint32_t thread_id) {
+			uint32_t shadow_count = 0u;
+			uint32_t gi_count = 0u;
+			for (uint32_t k(begin); k < end; ++k) {
+				const uint32_t i = m_hit_queue[k];
+				const HitPoint& hit = m_hits[i];
+				const float ambient_occlusion = raycaster.use_ao ? raycaster.getAmbientOcclusion(hit) : 1.0f;
+				m_shading[i] = raycaster.getAlbedo(hit, m_primary.getDirection(i), m_path_lengths[i]) * (m_throughputs[i] * ambient_occlusion);
+				std::fill(&m_lighting[m_slot_count * i], &m_lighting[m_slot_count * i] + m_slot_count, 0.0f);
+
+				m_shadow_candidates.weight[k] = -1.0f;
+				if (hit.cell->texture != Cell::Red) {
+					const glm::vec3 start = hit.position + hit.normal * raycaster.shadow_offset;
+					const glm::vec3 to_light = glm::normalize(raycaster.light_position - start);
+					m_shadow_candidates.set(k, start, to_light, m_slot_count * i, std::max(0.0f, glm::dot(to_light, hit.normal)));
+					++shadow_count;
+				}
+
+				m_gi_candidates.weight[k] = -1.0f;
+				if (getGIBounceCount(i) && hit.normal != glm::vec3(0.0f)) {
+					const glm::vec3 gi_ray = raycaster.getGIDirection(hit.normal);
+					m_gi_candidates.set(k, hit.position + hit.normal * raycaster.gi_offset, gi_ray, i, 0.0f, 0.5f);
+					++gi_count;
+				}
+			}
+			m_slice_counts[thread_id] = shadow_count;
+			m_gi_slice_counts[thread_id] = gi_count;
+		});
+	}
+
+	// Each GI ray that hit emits a shadow ray toward the light and, if its path survives, the ray of the next bounce
+	void traceGIRays(uint32_t bounce)
+	{
+		runStage(m_gi_queue.count, [&](uint32_t begin, uint32_t end, uint32_t thread_id) {
+			uint32_t shadow_count = 0u;
+			uint32_t gi_count = 0u;
+			for (uint32_t k(begin); k < end; ++k) {
+				const HitPoint gi_hit = raycaster.intersect(m_gi_queue.getOrigin(k), m_gi_queue.getDirection(k), m_gi_queue.size_coef[k], 0.0f);
+				m_shadow_candidates.weight[k] = -1.0f;
+				m_gi_candidates.weight[k] = -1.0f;
+				if (!gi_hit.cell) {
+					continue;
+				}
+
+				const uint32_t owner = m_gi_queue.owner[k];
+				float throughput = m_gi_queue.throughput[k];
+				const glm::vec3 start = gi_hit.position + gi_hit.normal * raycaster.gi_offset;
+				const glm::vec3 to_light = glm::normalize(raycaster.light_position - start);
+				const float weight = throughput * raycaster.getGILightWeight(gi_hit, to_light);
+				m_shadow_candidates.set(k, start, to_light, m_slot_count * owner + 1u + bounce, weight, 0.5f);
+				++shadow_count;
+
+				if (bounce + 1u < getGIBounceCount(owner) && raycaster.continuePath(throughput, gi_hit, int32_t(bounce))) {
+					const glm::vec3 gi_ray = raycaster.getGIDirection(gi_hit.normal);
+					m_gi_candidates.set(k, start, gi_ray, owner, 0.0f, 0.5f, throughput);
+					++gi_count;
+				}
+			}
+			m_slice_counts[thread_id] = shadow_count;
+			m_gi_slice_counts[thread_id] = gi_count;
+		});
+	}
+
+	// Each shadow ray owns its lighting slot so they are written without synchronization
+	void traceShadowRays()
+	{
+		runStage(m_shadow_queue.count, [&](uint32_t begin, uint32_t end, uint32_t thread_id) {
+			for (uint32_t k(begin); k < end; ++k) {
+				const HitPoint occluder = raycaster.intersect(m_shadow_queue.getOrigin(k), m_shadow_queue.getDirection(k), m_shadow_queue.size_coef[k], 0.0f);
+				if (!occluder.cell) {
+					m_lighting[m_shadow_queue.owner[k]] = m_shadow_queue.weight[k];
+				}
+			}
+		});
+	}
+
+	void resolve()
+	{
+		const sf::Vector2i& size = raycaster.render_size;
+		runStage(m_primary.count, [&](uint32_t begin, uint32_t end, uint32_t thread_id) {
+			for (uint32_t i(begin); i < end; ++i) {
+				const uint32_t pixel = m_primary.owner[i];
+				ColorResult result;
+				if (m_hits[i].cell) {
+					float lighting = 0.0f;
+					for (uint32_t slot(0u); slot < m_slot_count; ++slot) {
+						lighting += m_lighting[m_slot_count * i + slot];
+					}
+					lighting = std::min(1.0f, std::max(0.0f, lighting));
+					result.color = toColor(m_shading[i] * lighting);
+				}
+				result.distance = m_depths[i];
+				raycaster.setPixel(sf::Vector2i(pixel % size.x, pixel / size.x), result);
+			}
+		});
+	}
+
+	// Sorts the queue by direction octant, the same grouping as LSVO's mirror_mask, then by coarse Morton order of the
+	// origin. Keys are small enough for a single counting sort pass: each thread counts then scatters its own slice,
+	// bins are filled slice after slice so rays keep their order within a bin.
+	void binRays(RayBuffer& queue)
+	{
+		constexpr uint32_t BIN_COUNT = 1u << BIN_BITS;
+		const uint32_t count = queue.count;
+		const uint32_t thread_count = uint32_t(m_slice_counts.size());
+		m_keys.resize(std::max(uint32_t(m_keys.size()), count));
+		m_binned.reserve(count);
+
+		constexpr float MAX_COORD = float((1u << ORIGIN_BITS) - 1u);
+		const glm::vec3 origin_scale = float(1u << ORIGIN_BITS) / (bin_max - bin_min);
+		runStage(count, [&](uint32_t begin, uint32_t end, uint32_t thread_id) {
+			uint32_t* histogram = &m_histograms[thread_id * BIN_COUNT];
+			std::fill(histogram, histogram + BIN_COUNT, 0u);
+			for (uint32_t k(begin); k < end; ++k) {
+				const uint32_t octant = uint32_t(queue.direction_x[k] > 0.0f) | (uint32_t(queue.direction_y[k] > 0.0f) << 1u) | (uint32_t(queue.direction_z[k] > 0.0f) << 2u);
+				// Origins outside of the bins' volume share the border cells
+				const uint32_t x = uint32_t(std::min(std::max((queue.origin_x[k] - bin_min.x) * origin_scale.x, 0.0f), MAX_COORD));
+				const uint32_t y = uint32_t(std::min(std::max((queue.origin_y[k] - bin_min.y) * origin_scale.y, 0.0f), MAX_COORD));
+				const uint32_t z = uint32_t(std::min(std::max((queue.origin_z[k] - bin_min.z) * origin_scale.z, 0.0f), MAX_COORD));
+				m_keys[k] = uint16_t((octant << (3u * ORIGIN_BITS)) | uint32_t(mortonEncode(x, y, z)));
+				++histogram[m_keys[k]];
+			}
+		});
+
+		// Exclusive prefix sum over bins then slices
+		uint32_t offset = 0u;
+		for (uint32_t bin(0u); bin < BIN_COUNT; ++bin) {
+			for (uint32_t thread_id(0u); thread_id < thread_count; ++thread_id) {
+				uint32_t& bucket = m_histograms[thread_id * BIN_COUNT + bin];
+				const uint32_t bucket_size = bucket;
+				bucket = offset;
+				offset += bucket_size;
+			}
+		}
+
+		runStage(count, [&](uint32_t begin, uint32_t end, uint32_t thread_id) {
+			uint32_t* histogram = &m_histograms[thread_id * BIN_COUNT];
+			for (uint32_t k(begin); k < end; ++k) {
+				m_binned.copy(histogram[m_keys[k]]++, queue, k);
+			}
+		});
+		m_binned.count = count;
+		std::swap(queue, m_binned);
+	}
+
+	// First output index of a thread's slice, the prefix sum of the previous slices' counts
+	static uint32_t getOutputIndex(const std::vector<uint32_t>& slice_counts, uint32_t thread_id)
+	{
+		uint32_t index = 0u;
+		for (uint32_t i(0u); i < thread_id; ++i) {
+			index += slice_counts[i];
+		}
+		return index;
+	}
+
+	// Appends the valid candidates to the queue starting at first, keeping their order
+	void compactCandidates(const RayBuffer& candidates, const std::vector<uint32_t>& slice_counts, uint32_t candidate_count, RayBuffer& queue, uint32_t first)
+	{
+		runStage(candidate_count, [&](uint32_t begin, uint32_t end, uint32_t thread_id) {
+			uint32_t index = first + getOutputIndex(slice_counts, thread_id);
+			for (uint32_t k(begin); k < end; ++k) {
+				if (candidates.weight[k] >= 0.0f) {
+					queue.copy(index++, candidates, k);
+				}
+			}
+		});
+		queue.count = first + getOutputIndex(slice_counts, uint32_t(slice_counts.size()));
+	}
+};
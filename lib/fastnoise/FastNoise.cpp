@@ -478,6 +478,62 @@ FN_DECIMAL FastNoise::GetNoise(FN_DECIMAL x, FN_DECIMAL y) const
 	return 0;
 }
 
+template<typename Sampler>
+static void FillNoiseGrid(FN_DECIMAL* noiseSet, FN_DECIMAL xStart, FN_DECIMAL yStart, int xSize, int ySize, FN_DECIMAL step, FN_DECIMAL frequency, Sampler sampler)
+{
+	const FN_DECIMAL yf0 = yStart * frequency;
+	const FN_DECIMAL yfStep = step * frequency;
+	int index = 0;
+	for (int x = 0; x < xSize; x++)
+	{
+		const FN_DECIMAL xf = (xStart + x * step) * frequency;
+		for (int y = 0; y < ySize; y++)
+		{
+			noiseSet[index++] = sampler(xf, yf0 + y * yfStep);
+		}
+	}
+}
+
+void FastNoise::FillNoiseSet(FN_DECIMAL* noiseSet, FN_DECIMAL xStart, FN_DECIMAL yStart, int xSize, int ySize, FN_DECIMAL step) const
+{
+	switch (m_noiseType)
+	{
+	case Value:
+		FillNoiseGrid(noiseSet, xStart, yStart, xSize, ySize, step, m_frequency, [this](FN_DECIMAL x, FN_DECIMAL y) { return SingleValue(0, x, y); });
+		return;
+	case Perlin:
+		FillNoiseGrid(noiseSet, xStart, yStart, xSize, ySize, step, m_frequency, [this](FN_DECIMAL x, FN_DECIMAL y) { return SinglePerlin(0, x, y); });
+		return;
+	case Simplex:
+		FillNoiseGrid(noiseSet, xStart, yStart, xSize, ySize, step, m_frequency, [this](FN_DECIMAL x, FN_DECIMAL y) { return SingleSimplex(0, x, y); });
+		return;
+	case SimplexFractal:
+		switch (m_fractalType)
+		{
+		case FBM:
+			FillNoiseGrid(noiseSet, xStart, yStart, xSize, ySize, step, m_frequency, [this](FN_DECIMAL x, FN_DECIMAL y) { return SingleSimplexFractalFBM(x, y); });
+			return;
+		case Billow:
+			FillNoiseGrid(noiseSet, xStart, yStart, xSize, ySize, step, m_frequency, [this](FN_DECIMAL x, FN_DECIMAL y) { return SingleSimplexFractalBillow(x, y); });
+			return;
+		case RigidMulti:
+			FillNoiseGrid(noiseSet, xStart, yStart, xSize, ySize, step, m_frequency, [this](FN_DECIMAL x, FN_DECIMAL y) { return SingleSimplexFractalRigidMulti(x, y); });
+			return;
+		default:
+			// Same result as GetNoise for fractal types it doesn't know
+			FillNoiseGrid(noiseSet, xStart, yStart, xSize, ySize, step, FN_DECIMAL(1), [this](FN_DECIMAL x, FN_DECIMAL y) { return GetNoise(x, y); });
+			return;
+		}
+	case Cubic:
+		FillNoiseGrid(noiseSet, xStart, yStart, xSize, ySize, step, m_frequency, [this](FN_DECIMAL x, FN_DECIMAL y) { return SingleCubic(0, x, y); });
+		return;
+	default:
+		// Other types go through GetNoise, which applies the frequency itself
+		FillNoiseGrid(noiseSet, xStart, yStart, xSize, ySize, step, FN_DECIMAL(1), [this](FN_DECIMAL x, FN_DECIMAL y) { return GetNoise(x, y); });
+		return;
+	}
+}
+
 // White Noise
 FN_DECIMAL FastNoise::GetWhiteNoise(FN_DECIMAL x, FN_DECIMAL y, FN_DECIMAL z, FN_DECIMAL w) const
 {
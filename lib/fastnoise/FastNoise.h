@@ -181,6 +181,10 @@ public:
 
 	FN_DECIMAL GetNoise(FN_DECIMAL x, FN_DECIMAL y) const;
 
+	// Fills noiseSet with GetNoise() sampled on a xSize * ySize grid starting at (xStart, yStart)
+	// Values are stored as noiseSet[x * ySize + y], the noise type is resolved once for the whole set
+	void FillNoiseSet(FN_DECIMAL* noiseSet, FN_DECIMAL xStart, FN_DECIMAL yStart, int xSize, int ySize, FN_DECIMAL step = FN_DECIMAL(1)) const;
+
 	void GradientPerturb(FN_DECIMAL& x, FN_DECIMAL& y) const;
 	void GradientPerturbFractal(FN_DECIMAL& x, FN_DECIMAL& y) const;
 
@@ -131,6 +131,11 @@ public:
 		m_workers.clear();
 	}
 
+	bool isExecutionDone() const
+	{
+		return m_done_count == m_group_size;
+	}
+
 private:
 	const uint32_t       m_group_size;
 	const WorkerFunction m_job;
@@ -186,6 +191,12 @@ public:
 		}
 	}
 
+	// Doesn't block, waitExecutionDone still has to be called to give the workers back to the swarm
+	bool isExecutionDone() const
+	{
+		return !m_group || m_group->isExecutionDone();
+	}
+
 private:
 	std::shared_ptr<ExecutionGroup> m_group;
 };
@@ -218,10 +229,14 @@ public:
 			group_size = m_thread_count;
 		}
 
-		if (group_size > m_available_workers.size()) {
+		if (group_size > m_thread_count) {
 			return WorkGroup();
 		}
 
+		// Workers of a previous group may still be on their way back to the available list
+		std::unique_lock<std::mutex> ul(m_mutex);
+		m_available_condition.wait(ul, [this, group_size] { return m_available_workers.size() >= group_size; });
+
 		return WorkGroup(std::make_unique<ExecutionGroup>(job, group_size, m_available_workers));
 	}
 
@@ -233,6 +248,7 @@ private:
 	std::list<Worker*>  m_workers;
 	std::list<Worker*>  m_available_workers;
 	std::mutex m_mutex;
+	std::condition_variable m_available_condition;
 
 	void createWorker()
 	{
@@ -250,15 +266,18 @@ private:
 
 	void notifyWorkerReady(Worker* worker)
 	{
-		std::lock_guard<std::mutex> lg(m_mutex);
-		++m_ready_count;
-		m_available_workers.push_back(worker);
+		{
+			std::lock_guard<std::mutex> lg(m_mutex);
+			++m_ready_count;
+			m_available_workers.push_back(worker);
+		}
+		m_available_condition.notify_all();
 	}
 
 	friend Worker;
 };
 
-Worker::Worker(Swarm* swarm)
+inline Worker::Worker(Swarm* swarm)
 	: m_swarm(swarm)
 	, m_group(nullptr)
 	, m_id(0)
@@ -269,13 +288,13 @@ Worker::Worker(Swarm* swarm)
 {
 }
 
-void Worker::createThread()
+inline void Worker::createThread()
 {
 	lockReady();
 	m_thread = std::thread(&Worker::run, this);
 }
 
-void Worker::run()
+inline void Worker::run()
 {
 	while (true) {
 		waitReady();
@@ -290,27 +309,27 @@ void Worker::run()
 	}
 }
 
-void Worker::lockReady()
+inline void Worker::lockReady()
 {
 	m_ready_mutex.lock();
 }
 
-void Worker::unlockReady()
+inline void Worker::unlockReady()
 {
 	m_ready_mutex.unlock();
 }
 
-void Worker::lockDone()
+inline void Worker::lockDone()
 {
 	m_done_mutex.lock();
 }
 
-void Worker::unlockDone()
+inline void Worker::unlockDone()
 {
 	m_done_mutex.unlock();
 }
 
-void Worker::setJob(uint32_t id, ExecutionGroup* group)
+inline void Worker::setJob(uint32_t id, ExecutionGroup* group)
 {
 	m_id = id;
 	m_job = group->m_job;
@@ -318,24 +337,24 @@ void Worker::setJob(uint32_t id, ExecutionGroup* group)
 	m_group = group;
 }
 
-void Worker::stop()
+inline void Worker::stop()
 {
 	m_running = false;
 }
 
-void Worker::join()
+inline void Worker::join()
 {
 	m_thread.join();
 }
 
-void Worker::waitReady()
+inline void Worker::waitReady()
 {
 	m_swarm->notifyWorkerReady(this);
 	lockReady();
 	unlockReady();
 }
 
-void Worker::waitDone()
+inline void Worker::waitDone()
 {
 	m_group->notifyWorkerDone();
 	lockDone();
@@ -1,52 +1,319 @@
 #include "lsvo_utils.hpp"
+#include <algorithm>
 
 
-void compileSVO_rec(const Node* node, std::vector<LNode>& data, const uint32_t node_index, uint32_t& max_offset)
+const Cell* decodeCell(uint8_t color)
 {
-	if (node) {
-		const uint32_t child_pos = data.size();
-		const uint32_t offset = child_pos - node_index;
-		max_offset = offset > max_offset ? offset : max_offset;
-		data[node_index].child_offset = offset;
+	struct CellTable
+	{
+		CellTable()
+		{
+			for (uint8_t i(0U); i < 12U; ++i) {
+				cells[i].type = Cell::Type(i >> 2U);
+				cells[i].texture = Cell::Texture(i & 3U);
+			}
+		}
+
+		Cell cells[12];
+	};
+
+	static const CellTable table;
+	return &table.cells[color];
+}
+
 
-		bool empty = true;
-		for (uint8_t x(0U); x < 2; ++x) {
-			for (uint8_t y(0U); y < 2; ++y) {
-				for (uint8_t z(0U); z < 2; ++z) {
-					if (node->sub[x][y][z]) {
-						empty = false;
-						break;
+const Cell* compileSVO_rec(const NodePool& nodes, const Node& node, std::vector<LNode>& data, const uint32_t node_index, uint32_t& max_offset)
+{
+	const uint32_t child_pos = data.size();
+	const uint32_t offset = child_pos - node_index;
+	max_offset = offset > max_offset ? offset : max_offset;
+	data[node_index].child_offset = offset;
+
+	bool empty = true;
+	for (uint8_t x(0U); x < 2; ++x) {
+		for (uint8_t y(0U); y < 2; ++y) {
+			for (uint8_t z(0U); z < 2; ++z) {
+				if (node.sub[x][y][z] != Node::None) {
+					empty = false;
+					break;
+				}
+			}
+		}
+	}
+
+	if (empty) {
+		return nullptr;
+	}
+
+	for (uint8_t i(8U); i--;) {
+		data.emplace_back();
+	}
+
+	// Set to nullptr as soon as a child is missing or differs from the others
+	const Cell* uniform_cell = nullptr;
+	uint8_t uniform_count = 0U;
+	bool first_color = false;
+	for (uint8_t x(0U); x < 2; ++x) {
+		for (uint8_t y(0U); y < 2; ++y) {
+			for (uint8_t z(0U); z < 2; ++z) {
+				const uint32_t sub_node_index = node.sub[x][y][z];
+				if (sub_node_index != Node::None) {
+					const Node& sub_node = nodes[sub_node_index];
+					const uint8_t sub_index = z * 4 + y * 2 + x;
+					data[node_index].child_mask |= (1U << sub_index);
+					// std::cout << "Add child to IDX " << node_index << " Child Mask " << std::bitset<8>(data[node_index].child_mask) << std::endl;
+					const Cell* sub_cell = sub_node.leaf ? &sub_node.cell : compileSVO_rec(nodes, sub_node, data, child_pos + sub_index, max_offset);
+					if (sub_cell) {
+						data[child_pos + sub_index].color = encodeCell(*sub_cell);
+					}
+					if (!first_color) {
+						data[node_index].color = data[child_pos + sub_index].color;
+						first_color = true;
+					}
+					if (sub_cell) {
+						data[node_index].leaf_mask |= (1U << sub_index);
+						if (!uniform_count || (uniform_cell && *uniform_cell == *sub_cell)) {
+							uniform_cell = sub_cell;
+						}
+						else {
+							uniform_cell = nullptr;
+						}
+						++uniform_count;
 					}
 				}
 			}
 		}
+	}
 
-		if (!empty) {
-			for (uint8_t i(8U); i--;) {
-				data.emplace_back();
+	if (uniform_count == 8U && uniform_cell) {
+		// All the subtree has been appended after child_pos, drop it and let the parent mark this node as a leaf
+		data.resize(child_pos);
+		data[node_index] = LNode();
+		return uniform_cell;
+	}
+
+	return nullptr;
+}
+
+
+void collectCompileTasks_rec(const NodePool& nodes, const Node& node, uint32_t split_depth, std::vector<CompileTask>& tasks)
+{
+	for (uint8_t x(0U); x < 2; ++x) {
+		for (uint8_t y(0U); y < 2; ++y) {
+			for (uint8_t z(0U); z < 2; ++z) {
+				const uint32_t sub_node_index = node.sub[x][y][z];
+				if (sub_node_index == Node::None || nodes[sub_node_index].leaf) {
+					continue;
+				}
+				if (split_depth > 1U) {
+					collectCompileTasks_rec(nodes, nodes[sub_node_index], split_depth - 1U, tasks);
+				}
+				else {
+					CompileTask task;
+					task.node = &nodes[sub_node_index];
+					task.cell = nullptr;
+					tasks.push_back(std::move(task));
+				}
 			}
+		}
+	}
+}
 
-			for (uint8_t x(0U); x < 2; ++x) {
-				for (uint8_t y(0U); y < 2; ++y) {
-					for (uint8_t z(0U); z < 2; ++z) {
-						const Node* sub_node = node->sub[x][y][z];
-						if (sub_node) {
-							const uint8_t sub_index = z * 4 + y * 2 + x;
-							data[node_index].child_mask |= (1U << sub_index);
-							// std::cout << "Add child to IDX " << node_index << " Child Mask " << std::bitset<8>(data[node_index].child_mask) << std::endl;
-							if (!(sub_node->leaf)) {
-								compileSVO_rec(sub_node, data, child_pos + sub_index, max_offset);
-							}
-							else {
-								data[node_index].leaf_mask |= (1U << sub_index);
-							}
-						}
+
+const Cell* compileSVOTop_rec(const NodePool& nodes, const Node& node, std::vector<LNode>& data, const uint32_t node_index, uint32_t split_depth, std::vector<CompileTask>& tasks, uint32_t& next_task)
+{
+	const uint32_t child_pos = data.size();
+	data[node_index].child_offset = child_pos - node_index;
+
+	bool empty = true;
+	for (uint8_t i(0U); i < 8U && empty; ++i) {
+		empty = node.sub[i & 1U][(i >> 1U) & 1U][i >> 2U] == Node::None;
+	}
+
+	if (empty) {
+		return nullptr;
+	}
+
+	for (uint8_t i(8U); i--;) {
+		data.emplace_back();
+	}
+
+	const Cell* uniform_cell = nullptr;
+	uint8_t uniform_count = 0U;
+	bool first_color = false;
+	for (uint8_t x(0U); x < 2; ++x) {
+		for (uint8_t y(0U); y < 2; ++y) {
+			for (uint8_t z(0U); z < 2; ++z) {
+				const uint32_t sub_node_index = node.sub[x][y][z];
+				if (sub_node_index == Node::None) {
+					continue;
+				}
+
+				const Node& sub_node = nodes[sub_node_index];
+				const uint8_t sub_index = z * 4 + y * 2 + x;
+				data[node_index].child_mask |= (1U << sub_index);
+				const Cell* sub_cell = nullptr;
+				// The subtree's root is only merged later, its color is known now
+				uint8_t sub_color = 0U;
+				if (sub_node.leaf) {
+					sub_cell = &sub_node.cell;
+				}
+				else if (split_depth > 1U) {
+					sub_cell = compileSVOTop_rec(nodes, sub_node, data, child_pos + sub_index, split_depth - 1U, tasks, next_task);
+					sub_color = data[child_pos + sub_index].color;
+				}
+				else {
+					CompileTask& task = tasks[next_task++];
+					sub_cell = task.cell;
+					if (!sub_cell) {
+						// Room for the subtree where compileSVO_rec would have appended it. A node with a non uniform
+						// subtree can't collapse so this room is never dropped.
+						task.parent_index = node_index;
+						task.sub_index = sub_index;
+						task.base = uint32_t(data.size());
+						data.resize(data.size() + task.data.size() - 1U);
+						sub_color = task.data[0].color;
+					}
+				}
+
+				if (sub_cell) {
+					sub_color = encodeCell(*sub_cell);
+					data[child_pos + sub_index].color = sub_color;
+				}
+				if (!first_color) {
+					data[node_index].color = sub_color;
+					first_color = true;
+				}
+				if (sub_cell) {
+					data[node_index].leaf_mask |= (1U << sub_index);
+					if (!uniform_count || (uniform_cell && *uniform_cell == *sub_cell)) {
+						uniform_cell = sub_cell;
+					}
+					else {
+						uniform_cell = nullptr;
 					}
+					++uniform_count;
 				}
 			}
 		}
 	}
+
+	if (uniform_count == 8U && uniform_cell) {
+		data.resize(child_pos);
+		data[node_index] = LNode();
+		return uniform_cell;
+	}
+
+	return nullptr;
 }
 
 
+void mergeCompileTask(const CompileTask& task, std::vector<LNode>& data)
+{
+	const uint32_t slot = task.parent_index + data[task.parent_index].child_offset + task.sub_index;
+	// Offsets are relative so only the subtree's root has to be patched
+	LNode root = task.data[0];
+	root.child_offset = task.base + root.child_offset - 1U - slot;
+	data[slot] = root;
+	std::copy(task.data.begin() + 1, task.data.end(), data.begin() + task.base);
+}
+
 
+void OccupancyGrid::fill(const glm::ivec3& min, int32_t cube_size)
+{
+	for (int32_t z(min.z); z < min.z + cube_size; ++z) {
+		for (int32_t y(min.y); y < min.y + cube_size; ++y) {
+			// Rows are contiguous, set them word by word
+			uint64_t first = getIndex(glm::ivec3(min.x, y, z));
+			const uint64_t last = first + cube_size;
+			while (first < last) {
+				const uint64_t word_end = std::min(last, (first & ~uint64_t(63U)) + 64U);
+				const uint64_t count = word_end - first;
+				const uint64_t mask = count == 64U ? ~uint64_t(0U) : ((uint64_t(1U) << count) - 1U) << (first & 63U);
+				bits[first >> 6U] |= mask;
+				first = word_end;
+			}
+		}
+	}
+}
+
+
+void collectLeaves_rec(const std::vector<LNode>& data, uint32_t node_index, const glm::ivec3& origin, int32_t size, OccupancyGrid& grid, std::vector<VoxelLeaf>& leaves)
+{
+	const LNode& node = data[node_index];
+	const int32_t sub_size = size >> 1;
+	for (uint8_t i(0U); i < 8U; ++i) {
+		if (!((node.child_mask >> i) & 1U)) {
+			continue;
+		}
+
+		const uint32_t slot = node_index + node.child_offset + i;
+		const glm::ivec3 sub_origin = origin + sub_size * glm::ivec3(i & 1U, (i >> 1U) & 1U, i >> 2U);
+		if (!((node.leaf_mask >> i) & 1U)) {
+			collectLeaves_rec(data, slot, sub_origin, sub_size, grid, leaves);
+			continue;
+		}
+
+		// LSVO mirrors SVO coordinates on all axes
+		const glm::ivec3 render_min = glm::ivec3(grid.size - sub_size) - sub_origin;
+		grid.fill(render_min, sub_size);
+		if (sub_size == 1) {
+			leaves.push_back({slot, render_min});
+		}
+	}
+}
+
+
+void OcclusionTable::reset(const std::vector<VoxelLeaf>& leaves, uint32_t slot_count)
+{
+	const uint32_t word_count = (slot_count + 63U) / 64U;
+	slot_bits.assign(word_count, 0U);
+	for (const VoxelLeaf& leaf : leaves) {
+		slot_bits[leaf.slot >> 6U] |= uint64_t(1U) << (leaf.slot & 63U);
+	}
+	word_counts.resize(word_count);
+	uint32_t count = 0U;
+	for (uint32_t i(0U); i < word_count; ++i) {
+		word_counts[i] = count;
+		count += uint32_t(std::bitset<64>(slot_bits[i]).count());
+	}
+	faces.assign(leaves.size(), FaceOcclusion());
+}
+
+
+void bakeOcclusion(const OccupancyGrid& grid, const std::vector<VoxelLeaf>& leaves, OcclusionTable& occlusion, uint32_t first, uint32_t step)
+{
+	// Axes of HitPoint::voxel_coord for faces along x, y and z
+	constexpr uint8_t u_axes[3] = {2U, 0U, 0U};
+	constexpr uint8_t v_axes[3] = {1U, 2U, 1U};
+	const uint32_t leaf_count = uint32_t(leaves.size());
+	for (uint32_t i(first); i < leaf_count; i += step) {
+		const VoxelLeaf& leaf = leaves[i];
+		FaceOcclusion& leaf_occlusion = occlusion.faces[occlusion.getIndex(leaf.slot)];
+		for (uint8_t face(0U); face < 6U; ++face) {
+			const uint8_t axis = face >> 1U;
+			glm::ivec3 front = leaf.voxel;
+			front[axis] += (face & 1U) ? 1 : -1;
+			// Hidden faces can't be hit
+			if (grid.isOccupied(front)) {
+				continue;
+			}
+
+			uint8_t corners = 0U;
+			for (uint8_t corner(0U); corner < 4U; ++corner) {
+				glm::ivec3 side_u = front;
+				glm::ivec3 side_v = front;
+				side_u[u_axes[axis]] += (corner & 1U) ? 1 : -1;
+				side_v[v_axes[axis]] += (corner & 2U) ? 1 : -1;
+				glm::ivec3 diagonal = side_u;
+				diagonal[v_axes[axis]] = side_v[v_axes[axis]];
+				const uint8_t u = grid.isOccupied(side_u);
+				const uint8_t v = grid.isOccupied(side_v);
+				// Both sides already close the corner
+				const uint8_t level = (u && v) ? 3U : uint8_t(u + v + grid.isOccupied(diagonal));
+				corners |= level << (2U * corner);
+			}
+			leaf_occlusion.faces[face] = corners;
+		}
+	}
+}
@@ -4,6 +4,7 @@
 #include <glm/gtx/rotate_vector.hpp>
 #include <sstream>
 #include <fstream>
+#include <algorithm>
 
 #include "svo.hpp"
 #include "grid_3d.hpp"
@@ -16,6 +17,16 @@
 #include "event_manager.hpp"
 #include "lsvo.hpp"
 #include "lsvo_debug.hpp"
+#include "terrain_generator.hpp"
+#include "density_generator.hpp"
+#include "chunked_world.hpp"
+#include "brick_lsvo.hpp"
+#include "distance_field_lsvo.hpp"
+#include "tlas.hpp"
+#include "wavefront.hpp"
+#include "foveation.hpp"
+#include "frame_time_controller.hpp"
+#include "presenter.hpp"
 
 
 int32_t main()
@@ -30,22 +41,10 @@ int32_t main()
 	constexpr float render_scale = 0.75f;
 	constexpr uint32_t RENDER_WIDTH = uint32_t(win_width  * render_scale);
 	constexpr uint32_t RENDER_HEIGHT = uint32_t(win_height * render_scale);
-	sf::RenderTexture render_tex;
-	sf::RenderTexture denoised_tex;
-	render_tex.create(RENDER_WIDTH, RENDER_HEIGHT);
-	denoised_tex.create(RENDER_WIDTH, RENDER_HEIGHT);
-	
-	render_tex.setSmooth(false);
-
 	const float body_radius = 0.4f;
 
 	constexpr uint8_t max_depth = 9;
 	constexpr int32_t size = 1 << max_depth;
-	constexpr int32_t grid_size_x = size;
-	constexpr int32_t grid_size_y = size;
-	constexpr int32_t grid_size_z = size;
-	using Volume = SVO<max_depth>;
-	Volume* volume_raw = new Volume();
 
 	Camera camera;
 	camera.position = glm::vec3(256, 200, 256);
@@ -56,40 +55,77 @@ int32_t main()
 
 	EventManager event_manager(window);
 
-	// Building SVO
-	std::cout << "Building SVO..." << std::endl;
-	FastNoise myNoise;
-	myNoise.SetNoiseType(FastNoise::SimplexFractal);
-	for (uint32_t x = 0; x < grid_size_x; x++) {
-		for (uint32_t z = 0; z < grid_size_z; z++) {
-			int32_t max_height = grid_size_y;
-			float amp_x = x - grid_size_x * 0.5f;
-			float amp_z = z - grid_size_z * 0.5f;
-			float ratio = std::pow(1.0f - sqrt(amp_x * amp_x + amp_z * amp_z) / (10.0f * grid_size_x), 256.0f);
-			int32_t height = int32_t(64.0f * myNoise.GetNoise(float(0.75f * x), float(0.75f * z)) + 32);
-
-			const int32_t ground_level = 16;
-			for (int y(1); y < std::max(ground_level, std::min(max_height, height)); ++y) {
-				volume_raw->setCell(Cell::Solid, Cell::Grass, x, y + 256, z);
-			}
-		}
-	}
+	const uint32_t thread_count = 16U;
+	const uint32_t area_count = uint32_t(sqrt(thread_count));
+	swrm::Swarm swarm(thread_count);
 
-	for (int y(0); y < 200; ++y) {
-		//volume_raw->setCell(Cell::Solid, Cell::Grass, 256, y, 256);
-	}
+	// Chunks reached by rays are generated by a few background workers while frames are rendered
+	constexpr uint8_t chunk_depth = 5;
+	const uint32_t streaming_thread_count = 2U;
+	swrm::Swarm streaming_swarm(streaming_thread_count);
+	// Volumetric terrain with overhangs and caves by default, the heightfield is cheaper to generate.
+	// The generator is read by the streaming workers, it is only switched between jobs.
+	bool use_heightfield = event_manager.use_heightfield;
+	TerrainGenerator<max_depth> terrain_generator;
+	terrain_generator.noise.SetNoiseType(FastNoise::SimplexFractal);
+	DensityGenerator<max_depth> density_generator;
+	density_generator.cave_amplitude = 0.5f;
+	// Valleys deeper than 8 voxels below the mean surface are flooded with mirrors
+	density_generator.lake_y = density_generator.surface_y + 8.0f;
+	// BrickLSVO traces faster, it trades the last octree levels for dense 16x16x16 bricks, but it has no baked
+	// occlusion: using it here means dropping on_chunk_built and the baked AO.
+	// DistanceFieldLSVO adds empty space skipping, it pays off with chunks much larger than their 8x8x8 blocks.
+	ChunkedWorld<chunk_depth, LSVO> world([&](SVO<chunk_depth>& chunk, const glm::ivec3& origin) {
+		if (use_heightfield) {
+			terrain_generator.generateBrick(chunk, origin);
+		}
+		else {
+			density_generator.generateBrick(chunk, origin);
+		}
+	}, 8U, 4U, size);
+	// Occlusion is baked once per chunk while streaming, faces on chunk borders don't see the neighbor chunks
+	world.on_chunk_built = [](LSVO<chunk_depth>& chunk) {
+		chunk.bakeOcclusion();
+	};
 
 	constexpr float scale = 1.0f / size;
-	LSVO<max_depth> lsvo(*volume_raw);
-	std::cout << "Done." << std::endl;
-
-	delete volume_raw;
 
-	RayCaster raycaster(lsvo, sf::Vector2i(RENDER_WIDTH, RENDER_HEIGHT));
-
-	const uint32_t thread_count = 16U;
-	const uint32_t area_count = uint32_t(sqrt(thread_count));
-	swrm::Swarm swarm(thread_count);
+	RayCaster raycaster(world, sf::Vector2i(RENDER_WIDTH, RENDER_HEIGHT));
+	// Lens coordinates are spaced by 1 / RENDER_HEIGHT on a screen at distance fov
+	raycaster.ray_size_coef = 1.0f / (float(RENDER_HEIGHT) * camera.fov);
+
+	// Moving entities share one small model, only their BVH is refitted each frame
+	constexpr uint8_t entity_depth = 3;
+	SVO<entity_depth> entity_svo;
+	entity_svo.fillBox(Cell::Solid, Cell::Grass, glm::uvec3(1U), glm::uvec3(7U));
+	const LSVO<entity_depth> entity_model(entity_svo);
+	const uint32_t entity_count = 256U;
+	auto getEntityPosition = [&](uint32_t i, float t) {
+		const float angle = 0.2f * t + 6.2831853f * float(i) / float(entity_count);
+		const float radius = 32.0f + 4.0f * float(i % 16U);
+		return glm::vec3(256.0f + radius * cos(angle), 120.0f - 4.0f * float(i % 8U), 256.0f + radius * sin(angle)) * scale + glm::vec3(1.0f);
+	};
+	TLAS<entity_depth> entities;
+	for (uint32_t i(0U); i < entity_count; ++i) {
+		entities.instances.emplace_back(&entity_model, getEntityPosition(i, 0.0f), glm::mat3(1.0f), 8.0f * scale);
+	}
+	// One standing mirror among them, made of the same depth of model
+	SVO<entity_depth> mirror_svo;
+	mirror_svo.fillBox(Cell::Mirror, Cell::White, glm::uvec3(0U, 0U, 3U), glm::uvec3(8U, 8U, 5U));
+	const LSVO<entity_depth> mirror_model(mirror_svo);
+	entities.instances.emplace_back(&mirror_model, glm::vec3(224.0f, 260.0f, 320.0f) * scale + glm::vec3(1.0f), glm::mat3(1.0f), 64.0f * scale);
+	entities.build();
+	raycaster.dynamic_layer = &entities;
+
+	WavefrontRenderer wavefront(raycaster, swarm, thread_count);
+	wavefront.bin_gi_rays = true;
+	// Full rate around the center of the screen, where the focal point is aimed
+	Foveation foveation(sf::Vector2i(RENDER_WIDTH, RENDER_HEIGHT));
+	// Raycasting budget, leaves time for the presentation of a 30 FPS frame
+	FrameTimeController frame_time_controller(1.0f / 40.0f);
+	// Time at which each raycasting thread finished its tiles, the presentation overlapping them isn't measured
+	std::vector<float> worker_end_times(thread_count, 0.0f);
+	Presenter presenter(sf::Vector2i(RENDER_WIDTH, RENDER_HEIGHT), swarm);
 
 	sf::Mouse::setPosition(sf::Vector2i(win_width / 2, win_height / 2), window);
 
@@ -110,9 +146,28 @@ int32_t main()
 		}
 
 		event_manager.processEvents(controller, camera, raycaster);
+		if (event_manager.use_heightfield != use_heightfield) {
+			world.clear();
+			use_heightfield = event_manager.use_heightfield;
+		}
+
+		// Publish chunks loaded since last frame and generate the ones rays reached
+		const bool chunks_published = world.update(camera.position * scale + glm::vec3(1.0f), streaming_swarm);
+		// The light map follows the window and is only recomputed when it moves or gets new chunks
+		raycaster.god_rays.light_cache.setBounds(world.getWindowMin(), world.getWindowMax());
+		if (chunks_published) {
+			raycaster.god_rays.light_cache.invalidate();
+		}
+		wavefront.bin_min = world.getWindowMin();
+		wavefront.bin_max = world.getWindowMax();
+
+		for (uint32_t i(0U); i < entity_count; ++i) {
+			entities.instances[i].position = getEntityPosition(i, time);
+		}
+		entities.refit();
 
 		// Computing camera's focal length based on aimed point
-		HitPoint closest_point = camera.getClosestPoint(lsvo);
+		HitPoint closest_point = camera.getClosestPoint(world);
 		if (closest_point.cell) {
 			camera.focal_length = closest_point.distance * size;
 		}
@@ -124,6 +179,8 @@ int32_t main()
 		const glm::vec3 light_position = glm::vec3(-200, -1000, -300);
 		//const glm::vec3 light_position = glm::vec3(300 + 500 * cos(light_speed*time), 0, 256 + 1000 * sin(light_speed*time));
 		raycaster.setLightPosition(light_position * scale + glm::vec3(1.0f));
+		// At most one reflection ray per rendered pixel on average, whatever the mirrors cover
+		raycaster.setReflectionBudget(RENDER_WIDTH * RENDER_HEIGHT / 2);
 
 		sf::Clock render_clock;
 
@@ -133,53 +190,100 @@ int32_t main()
 		const float aspect_ratio = float(RENDER_WIDTH) / float(RENDER_HEIGHT);
 		const uint32_t rays = raycaster.use_samples ? 32000U : 8000U;
 
+		// God rays are marched first at low resolution, pixels then upsample them while being shaded
+		if (raycaster.use_god_rays) {
+			GodRays& god_rays = raycaster.god_rays;
+			// Bounds the number of shadow rays cast to refresh the light cache
+			god_rays.light_cache.setBudget(4096);
+			swarm.execute([&](uint32_t thread_id, uint32_t max_thread) {
+				const int32_t texel_count = god_rays.size.x * god_rays.size.y;
+				for (int32_t i(thread_id); i < texel_count; i += max_thread) {
+					const sf::Vector2i texel(i % god_rays.size.x, i / god_rays.size.x);
+					const sf::Vector2i pixel = god_rays.getSamplePixel(texel);
+					const float lens_x = float(pixel.x) / float(RENDER_HEIGHT) - aspect_ratio * 0.5f;
+					const float lens_y = float(pixel.y) / float(RENDER_HEIGHT) - 0.5f;
+					const CameraRay camera_ray = camera.getRay(glm::vec2(lens_x, lens_y));
+					raycaster.renderGodRays(texel, (camera.position + camera_ray.world_rand_offset)*scale + glm::vec3(1.0f), camera_ray.ray);
+				}
+			}).waitExecutionDone();
+			++god_rays.frame;
+		}
+
+		// The previous frame is presented while this one is raycasted
+		const auto present = [&]() {
+			presenter.draw(window, 1.0f / render_scale);
+			window.display();
+		};
+
+		// Raycasting time of the frame, the quality of the next one follows it
+		float raycast_time = 0.0f;
 		// Change checker board offset ot render the other pixels
 		checker_board_offset = 1 - checker_board_offset;
-		// The actual raycasting
-		auto group = swarm.execute([&](uint32_t thread_id, uint32_t max_thread) {
-			const uint32_t start_x = thread_id % 4;
-			const uint32_t start_y = thread_id / 4;
-			for (uint32_t x(start_x * area_width); x < (start_x + 1) * area_width; ++x) {
-				for (uint32_t y(start_y * area_height + (x + checker_board_offset) % 2); y < (start_y + 1) * area_height; y += 2) {
-					// Computing ray coordinates in 'lens' space ie in normalized screen space
-					const float lens_x = float(x) / float(RENDER_HEIGHT) - aspect_ratio * 0.5f;
-					const float lens_y = float(y) / float(RENDER_HEIGHT) - 0.5f;
-					// Get ray to cast with stochastic blur baked into it
-					const CameraRay camera_ray = camera.getRay(glm::vec2(lens_x, lens_y));
-					raycaster.renderRay(sf::Vector2i(x, y), (camera.position + camera_ray.world_rand_offset)*scale + glm::vec3(1.0f), camera_ray.ray, time);
+		if (raycaster.use_wavefront) {
+			// Stages wait for each other, there is nothing to overlap with
+			wavefront.render(camera, scale, checker_board_offset);
+			raycast_time = render_clock.getElapsedTime().asSeconds();
+			present();
+		}
+		else if (raycaster.use_foveation || raycaster.use_dynamic_resolution) {
+			if (raycaster.use_dynamic_resolution) {
+				foveation.setQuality(frame_time_controller.quality);
+			}
+			foveation.update();
+			// Tiles are interleaved between threads, they don't all have the same cost
+			auto group = swarm.execute([&](uint32_t thread_id, uint32_t max_thread) {
+				const int32_t tile_count = foveation.tile_count.x * foveation.tile_count.y;
+				for (int32_t tile(thread_id); tile < tile_count; tile += max_thread) {
+					foveation.renderTile(tile, checker_board_offset, [&](int32_t x, int32_t y) {
+						const float lens_x = float(x) / float(RENDER_HEIGHT) - aspect_ratio * 0.5f;
+						const float lens_y = float(y) / float(RENDER_HEIGHT) - 0.5f;
+						const CameraRay camera_ray = camera.getRay(glm::vec2(lens_x, lens_y));
+						raycaster.renderRay(sf::Vector2i(x, y), (camera.position + camera_ray.world_rand_offset)*scale + glm::vec3(1.0f), camera_ray.ray, time);
+					});
 				}
+				worker_end_times[thread_id] = render_clock.getElapsedTime().asSeconds();
+			});
+			present();
+			group.waitExecutionDone();
+			raycast_time = *std::max_element(worker_end_times.begin(), worker_end_times.end());
+			// Accumulated samples already cover the skipped pixels
+			if (!raycaster.use_samples) {
+				foveation.upsample(raycaster.render_image, raycaster.depths, swarm);
 			}
-		});
-		// Wait for threads to terminate
-		group.waitExecutionDone();
+		}
+		else {
+			// The actual raycasting
+			auto group = swarm.execute([&](uint32_t thread_id, uint32_t max_thread) {
+				const uint32_t start_x = thread_id % 4;
+				const uint32_t start_y = thread_id / 4;
+				for (uint32_t x(start_x * area_width); x < (start_x + 1) * area_width; ++x) {
+					for (uint32_t y(start_y * area_height + (x + checker_board_offset) % 2); y < (start_y + 1) * area_height; y += 2) {
+						// Computing ray coordinates in 'lens' space ie in normalized screen space
+						const float lens_x = float(x) / float(RENDER_HEIGHT) - aspect_ratio * 0.5f;
+						const float lens_y = float(y) / float(RENDER_HEIGHT) - 0.5f;
+						// Get ray to cast with stochastic blur baked into it
+						const CameraRay camera_ray = camera.getRay(glm::vec2(lens_x, lens_y));
+						raycaster.renderRay(sf::Vector2i(x, y), (camera.position + camera_ray.world_rand_offset)*scale + glm::vec3(1.0f), camera_ray.ray, time);
+					}
+				}
+			});
+			present();
+			// Wait for threads to terminate
+			group.waitExecutionDone();
+		}
 
 		if (raycaster.use_samples) {
 			raycaster.samples_to_image();
 		}
 
+		// Quality of the next frame
+		if (raycaster.use_dynamic_resolution) {
+			frame_time_controller.update(raycast_time);
+		}
+
 		// Add some persistence to reduce the noise
 		const float old_value_conservation = raycaster.use_samples ? 0.0f : 0.1f;
-		sf::RectangleShape cache1(sf::Vector2f(RENDER_WIDTH, RENDER_HEIGHT));
-		cache1.setFillColor(sf::Color(255 * old_value_conservation, 255 * old_value_conservation, 255 * old_value_conservation));
-		sf::RectangleShape cache2(sf::Vector2f(win_width, win_height));
-		const float c2 = 255 * (1.0f - old_value_conservation);
-		cache2.setFillColor(sf::Color(c2, c2, c2));
-		// Draw image to final render texture
-		sf::Texture texture;
-		texture.loadFromImage(raycaster.render_image);
-		render_tex.draw(sf::Sprite(texture));
-		render_tex.draw(cache2, sf::BlendMultiply);
-		render_tex.display();
-		// Not really denoised but OK
-		denoised_tex.draw(cache1, sf::BlendMultiply);
-		sf::Sprite render_sprite(render_tex.getTexture());
-		denoised_tex.draw(render_sprite, sf::BlendAdd);
-		denoised_tex.display();
-		// Scale and render
-		sf::Sprite final_sprite(denoised_tex.getTexture());
-		final_sprite.setScale(1.0f / render_scale, 1.0f / render_scale);
-		window.draw(final_sprite);
-		window.display();
+		presenter.submit(raycaster.render_image, old_value_conservation);
 
 		const float dt = frame_clock.getElapsedTime().asSeconds();
 		++frame_count;
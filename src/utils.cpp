@@ -56,6 +56,12 @@ void mult(sf::Color& color1, const sf::Color& color2)
 	color1.b = std::uint8_t(color1.b * color2.b * inv);
 }
 
+sf::Color toColor(const glm::vec3& color)
+{
+	const glm::vec3 scaled = glm::min(glm::max(color, glm::vec3(0.0f)), glm::vec3(1.0f)) * 255.0f;
+	return sf::Color(std::uint8_t(scaled.x), std::uint8_t(scaled.y), std::uint8_t(scaled.z));
+}
+
 
 float frac(float f)
 {
@@ -116,3 +122,21 @@ float intAsFloat(const uint32_t i)
 {
 	return *(float*)(&i);
 }
+
+
+static uint64_t splitBy3(uint32_t v)
+{
+	uint64_t x = v & 0x1fffff;
+	x = (x | x << 32) & 0x1f00000000ffff;
+	x = (x | x << 16) & 0x1f0000ff0000ff;
+	x = (x | x << 8)  & 0x100f00f00f00f00f;
+	x = (x | x << 4)  & 0x10c30c30c30c30c3;
+	x = (x | x << 2)  & 0x1249249249249249;
+	return x;
+}
+
+
+uint64_t mortonEncode(uint32_t x, uint32_t y, uint32_t z)
+{
+	return splitBy3(x) | (splitBy3(y) << 1) | (splitBy3(z) << 2);
+}